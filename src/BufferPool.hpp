@@ -0,0 +1,143 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "Pool.hpp"
+
+namespace ByfronUtils {
+
+// Byte buffers of varying size, pooled by capacity class. Every power of
+// two above MIN_CAPACITY is split into four classes, so acquire() wastes
+// under a quarter of the capacity it hands out. Each class is a Pool of
+// buffers reserved to the class capacity; a buffer keeps its capacity
+// when released and comes back empty. A class owns at most
+// max_class_bytes of buffers, past that it hands out plain heap buffers
+// freed on release. A buffer whose capacity changed while out goes back
+// as a fresh one of the class capacity, so the budget holds. Requests
+// above maxCapacity() get unpooled buffers. Buffers still out when the
+// pool is gone are deleted by their handles.
+class BufferPool {
+
+public:
+	typedef std::vector<char> Buffer;
+
+	// Move-only owner of an acquired buffer, gives it back on destruction
+	class Handle {
+	public:
+		Handle() : _capacity(0) {}
+		Handle(Handle && other) : _pooled(std::move(other._pooled)),
+					  _unpooled(std::move(other._unpooled)), _capacity(other._capacity) {}
+		~Handle() { reset(); }
+
+		Handle & operator=(Handle && other) {
+			if (this != &other) {
+				reset();
+				_pooled = std::move(other._pooled);
+				_unpooled = std::move(other._unpooled);
+				_capacity = other._capacity;
+			}
+			return *this;
+		}
+
+		Buffer * get() const { return _pooled ? _pooled.get() : _unpooled.get(); }
+		Buffer & operator*() const { return *get(); }
+		Buffer * operator->() const { return get(); }
+		explicit operator bool() const { return get() != nullptr; }
+
+		void reset() {
+			if (_pooled && _pooled->capacity() != _capacity) {
+				Buffer fresh;
+				fresh.reserve(_capacity);
+				_pooled->swap(fresh);
+			}
+			_pooled.reset();
+			_unpooled.reset();
+		}
+
+	private:
+		friend class BufferPool;
+		Handle(const Handle &);
+		Handle & operator=(const Handle &);
+
+		Pool<Buffer>::Handle _pooled;
+		std::unique_ptr<Buffer> _unpooled; // above maxCapacity()
+		std::size_t _capacity; // when acquired
+	};
+
+	static const std::size_t MIN_CAPACITY = 64;
+
+	explicit BufferPool(std::size_t max_capacity = 1 << 20, std::size_t max_class_bytes = 1 << 22) {
+		for (std::size_t c = 0; c <= classFor(max_capacity); c++) {
+			std::size_t capacity = classCapacity(c);
+			Pool<Buffer>::Policy policy;
+			policy.max_bytes = max_class_bytes;
+			policy.object_bytes = capacity;
+			policy.heap_fallback = true;
+			policy.order = Pool<Buffer>::LIFO;
+			_classes.push_back(std::unique_ptr<Pool<Buffer> >(new Pool<Buffer>([capacity]() {
+				std::unique_ptr<Buffer> buffer(new Buffer());
+				buffer->reserve(capacity);
+				return buffer;
+			}, policy)));
+		}
+	}
+
+	// Empty buffer from the smallest class holding bytes, or an unpooled
+	// one of exactly bytes above maxCapacity()
+	Handle acquire(std::size_t bytes) {
+		Handle buffer;
+		if (bytes > maxCapacity()) {
+			buffer._unpooled.reset(new Buffer());
+			buffer._unpooled->reserve(bytes);
+			return buffer;
+		}
+		std::size_t c = classFor(bytes);
+		buffer._pooled = _classes[c]->tryAcquire();
+		buffer._capacity = buffer->capacity();
+		buffer->clear();
+		return buffer;
+	}
+
+	// Capacity acquire(bytes) hands out
+	std::size_t capacityFor(std::size_t bytes) const {
+		return bytes > maxCapacity() ? bytes : classCapacity(classFor(bytes));
+	}
+
+	// Capacity of the largest class
+	std::size_t maxCapacity() const {
+		return classCapacity(_classes.size() - 1);
+	}
+
+	// Capacity of the free buffers, in bytes. Each holds what reserve()
+	// gave it for its class, as grown buffers are replaced on release.
+	std::size_t retained() const {
+		std::size_t bytes = 0;
+		for (std::size_t c = 0; c < _classes.size(); c++)
+			bytes += _classes[c]->size() * classCapacity(c);
+		return bytes;
+	}
+
+private:
+	BufferPool(const BufferPool &);
+	BufferPool & operator=(const BufferPool &);
+
+	static const std::size_t UNIT = MIN_CAPACITY / 4;
+
+	// (4 + c % 4) units, doubled c / 4 times
+	static std::size_t classCapacity(std::size_t c) {
+		return ((4 + (c & 3)) * UNIT) << (c >> 2);
+	}
+
+	static std::size_t classFor(std::size_t bytes) {
+		std::uint64_t units = (bytes + UNIT - 1) / UNIT;
+		if (units <= 4) return 0;
+		int shift = 61 - __builtin_clzll(units - 1);
+		std::size_t top = (units - 1) >> shift; // 4 to 7
+		return shift * 4 + top - 3;
+	}
+
+	std::vector<std::unique_ptr<Pool<Buffer> > > _classes;
+};
+
+}
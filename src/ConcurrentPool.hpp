@@ -0,0 +1,323 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <assert.h>
+#include "ThreadSlot.hpp"
+
+namespace ByfronUtils {
+
+// Pool whose acquire() and release are lock-free and safe from any thread.
+// Free objects form a Treiber stack of node indices; the head carries a
+// 32 bit tag bumped by every update, so a node popped and pushed back
+// between a load and a CAS (ABA) fails the CAS. Nodes live in segments
+// that are never moved nor freed before the pool, so reading a stale
+// node's link is harmless. The pool must outlive the objects it hands out.
+//
+// With a magazine size, every thread also caches up to two magazines of
+// free objects and trades whole magazines with the shared depot (one CAS)
+// only when both run empty or full, so most acquires and releases touch
+// thread-local memory only. Cached objects are not counted by size(), and
+// stay with a thread's slot after it exits until another thread takes the
+// slot; call flush() before a thread exits to hand them back.
+template <typename T>
+class ConcurrentPool {
+
+private:
+	static const int FIRST_SEGMENT_BITS = 6;
+	static const int NUM_SEGMENTS = 32 - FIRST_SEGMENT_BITS;
+	static const std::uint32_t NONE = 0xffffffff;
+
+	struct Node {
+		Node() : next(0), batch(0) {}
+		std::unique_ptr<T> object;
+		std::atomic<std::uint32_t> next;  // index + 1 of the next free node, 0 ends
+		std::atomic<std::uint32_t> batch; // same, for the next full magazine in the depot
+	};
+
+	// Owned by one thread slot. loaded serves acquires and releases,
+	// previous is swapped in before going to the depot.
+	struct Magazine {
+		Magazine(std::size_t size) : loaded(new std::uint32_t[size]), previous(new std::uint32_t[size]),
+					     loaded_count(0), previous_count(0) {}
+
+		void swap() {
+			std::swap(loaded, previous);
+			std::swap(loaded_count, previous_count);
+		}
+
+		std::unique_ptr<std::uint32_t[]> loaded, previous;
+		std::size_t loaded_count, previous_count;
+		char padding[64];
+	};
+
+	struct Releaser {
+		Releaser() : pool(nullptr), index(NONE) {}
+		Releaser(ConcurrentPool<T> * p, std::uint32_t i) : pool(p), index(i) {}
+
+		void operator()(T *) {
+			pool->release(index);
+		}
+
+		ConcurrentPool<T> * pool;
+		std::uint32_t index;
+	};
+
+	// segment s holds 2^(s + FIRST_SEGMENT_BITS) nodes
+	Node & node(std::uint32_t index) {
+		std::uint64_t i = std::uint64_t(index) + (1 << FIRST_SEGMENT_BITS);
+		int msb = 63 - __builtin_clzll(i);
+		Node * segment = _segments[msb - FIRST_SEGMENT_BITS].load(std::memory_order_acquire);
+		return segment[i - (std::uint64_t(1) << msb)];
+	}
+
+	// Treiber stack over the nodes linked through link
+	std::uint32_t pop(std::atomic<std::uint64_t> & top, std::atomic<std::uint32_t> Node::* link) {
+		std::uint64_t head = top.load(std::memory_order_acquire);
+		while (std::uint32_t(head)) {
+			std::uint32_t index = std::uint32_t(head) - 1;
+			std::uint32_t next = (node(index).*link).load(std::memory_order_relaxed);
+			std::uint64_t tagged = (((head >> 32) + 1) << 32) | next;
+			if (top.compare_exchange_weak(head, tagged, std::memory_order_acq_rel,
+						      std::memory_order_acquire))
+				return index;
+		}
+		return NONE;
+	}
+
+	void push(std::atomic<std::uint64_t> & top, std::atomic<std::uint32_t> Node::* link,
+		  std::uint32_t index) {
+		Node & n = node(index);
+		std::uint64_t head = top.load(std::memory_order_relaxed);
+		std::uint64_t tagged;
+		do {
+			(n.*link).store(std::uint32_t(head), std::memory_order_relaxed);
+			tagged = (((head >> 32) + 1) << 32) | (index + 1);
+		} while (!top.compare_exchange_weak(head, tagged, std::memory_order_release,
+						    std::memory_order_relaxed));
+	}
+
+	std::uint32_t pop() {
+		std::uint32_t index = pop(_head, &Node::next);
+		if (index != NONE) _size.fetch_sub(1, std::memory_order_relaxed);
+		return index;
+	}
+
+	void push(std::uint32_t index) {
+		push(_head, &Node::next, index);
+		_size.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Pops up to n nodes with a single CAS, first is the head of the chain
+	std::size_t popChain(std::size_t n, std::uint32_t & first) {
+		std::uint64_t head = _head.load(std::memory_order_acquire);
+		while (std::uint32_t(head)) {
+			// the links read here are only used if no push or pop slipped in,
+			// which the tag on the head would show
+			first = std::uint32_t(head) - 1;
+			std::size_t k = 1;
+			std::uint32_t next = node(first).next.load(std::memory_order_relaxed);
+			for (std::uint32_t last; k < n && next; k++) {
+				last = next - 1;
+				next = node(last).next.load(std::memory_order_relaxed);
+			}
+			std::uint64_t tagged = (((head >> 32) + 1) << 32) | next;
+			if (_head.compare_exchange_weak(head, tagged, std::memory_order_acq_rel,
+							std::memory_order_acquire)) {
+				_size.fetch_sub(k, std::memory_order_relaxed);
+				return k;
+			}
+		}
+		return 0;
+	}
+
+	// Pushes the chain first..last, already linked, with a single CAS
+	void pushChain(std::uint32_t first, std::uint32_t last, std::size_t n) {
+		Node & tail = node(last);
+		std::uint64_t head = _head.load(std::memory_order_relaxed);
+		std::uint64_t tagged;
+		do {
+			tail.next.store(std::uint32_t(head), std::memory_order_relaxed);
+			tagged = (((head >> 32) + 1) << 32) | (first + 1);
+		} while (!_head.compare_exchange_weak(head, tagged, std::memory_order_release,
+						      std::memory_order_relaxed));
+		_size.fetch_add(n, std::memory_order_relaxed);
+	}
+
+	// Moves a full magazine from the depot into items, false if none
+	bool popBatch(std::uint32_t * items) {
+		std::uint32_t index = pop(_batches, &Node::batch);
+		if (index == NONE) return false;
+		for (std::size_t i = 0; i < _magazine_size; i++) {
+			items[i] = index;
+			index = node(index).next.load(std::memory_order_relaxed) - 1;
+		}
+		_size.fetch_sub(_magazine_size, std::memory_order_relaxed);
+		return true;
+	}
+
+	void pushBatch(const std::uint32_t * items) {
+		for (std::size_t i = 0; i + 1 < _magazine_size; i++)
+			node(items[i]).next.store(items[i + 1] + 1, std::memory_order_relaxed);
+		push(_batches, &Node::batch, items[0]);
+		_size.fetch_add(_magazine_size, std::memory_order_relaxed);
+	}
+
+	Magazine * magazine() {
+		if (!_magazine_size) return nullptr;
+		int slot = ThreadSlot::get();
+		if (slot < 0) return nullptr;
+		if (!_magazines[slot]) _magazines[slot].reset(new Magazine(_magazine_size));
+		return _magazines[slot].get();
+	}
+
+	std::uint32_t take() {
+		Magazine * m = magazine();
+		if (!m) return pop();
+
+		if (!m->loaded_count && m->previous_count) m->swap();
+		if (!m->loaded_count) {
+			if (popBatch(m->loaded.get())) m->loaded_count = _magazine_size;
+			else return pop();
+		}
+		return m->loaded[--m->loaded_count];
+	}
+
+	void release(std::uint32_t index) {
+		Magazine * m = magazine();
+		if (!m) return push(index);
+
+		if (m->loaded_count == _magazine_size) {
+			if (m->previous_count == _magazine_size) {
+				pushBatch(m->previous.get());
+				m->previous_count = 0;
+			}
+			m->swap();
+		}
+		m->loaded[m->loaded_count++] = index;
+	}
+
+	std::atomic<Node *> _segments[NUM_SEGMENTS];
+	std::uint32_t _count; // nodes created, guarded by _grow
+	std::mutex _grow;
+	std::size_t _magazine_size;
+	std::vector<std::unique_ptr<Magazine> > _magazines;
+
+	char _pad[64];
+	std::atomic<std::uint64_t> _head; // tag << 32 | index + 1
+	std::atomic<std::uint64_t> _batches;
+	std::atomic<std::size_t> _size;
+
+public:
+
+	using PtrType = std::unique_ptr<T, Releaser>;
+
+	// magazine_size 0 leaves out the thread caches
+	explicit ConcurrentPool(std::size_t magazine_size = 0) : _count(0), _magazine_size(magazine_size),
+								 _head(0), _batches(0), _size(0) {
+		for (int s = 0; s < NUM_SEGMENTS; s++) _segments[s] = nullptr;
+		if (_magazine_size) _magazines.resize(ThreadSlot::MAX);
+	}
+
+	~ConcurrentPool() {
+		for (int s = 0; s < NUM_SEGMENTS; s++)
+			delete [] _segments[s].load();
+	}
+
+	// Takes a lock when the pool grows into a new segment
+	void add(std::unique_ptr<T> t) {
+		std::uint32_t index;
+		{
+			std::unique_lock<std::mutex> lock(_grow);
+			index = _count;
+			assert(index != NONE);
+
+			int s = 63 - __builtin_clzll(std::uint64_t(index) + (1 << FIRST_SEGMENT_BITS))
+				- FIRST_SEGMENT_BITS;
+			if (!_segments[s].load(std::memory_order_relaxed))
+				_segments[s].store(new Node[std::size_t(1) << (s + FIRST_SEGMENT_BITS)],
+						   std::memory_order_release);
+
+			node(index).object = std::move(t);
+			_count++;
+		}
+		push(index);
+	}
+
+	// Empty pointer when the pool is exhausted
+	PtrType acquire() {
+		std::uint32_t index = take();
+		if (index == NONE) return PtrType();
+		return PtrType(node(index).object.get(), Releaser(this, index));
+	}
+
+	// Writes up to n objects to out and returns how many. Without magazines
+	// the whole chain comes off the free list with one CAS.
+	template <typename OutputIt>
+	std::size_t acquireN(OutputIt out, std::size_t n) {
+		if (_magazine_size) {
+			std::size_t k = 0;
+			for (; k < n; k++) {
+				std::uint32_t index = take();
+				if (index == NONE) break;
+				*out++ = PtrType(node(index).object.get(), Releaser(this, index));
+			}
+			return k;
+		}
+
+		std::uint32_t index = NONE;
+		std::size_t k = n ? popChain(n, index) : 0;
+		for (std::size_t i = 0; i < k; i++) {
+			std::uint32_t next = node(index).next.load(std::memory_order_relaxed) - 1;
+			*out++ = PtrType(node(index).object.get(), Releaser(this, index));
+			index = next;
+		}
+		return k;
+	}
+
+	// Gives back every pointer in [first, last), linking them into one chain
+	// pushed with a single CAS. Empty pointers and those of other pools
+	// are released as usual.
+	template <typename Iterator>
+	void releaseN(Iterator first, Iterator last) {
+		std::uint32_t head = NONE, tail = NONE;
+		std::size_t n = 0;
+		for (; first != last; ++first) {
+			if (!*first) continue;
+			if (first->get_deleter().pool != this || _magazine_size) {
+				first->reset();
+				continue;
+			}
+			std::uint32_t index = first->get_deleter().index;
+			first->release();
+			if (tail == NONE) tail = index;
+			else node(index).next.store(head + 1, std::memory_order_relaxed);
+			head = index;
+			n++;
+		}
+		if (n) pushChain(head, tail, n);
+	}
+
+	// Gives the calling thread's cached objects back to the depot
+	void flush() {
+		Magazine * m = magazine();
+		if (!m) return;
+		for (; m->loaded_count; m->loaded_count--) push(m->loaded[m->loaded_count - 1]);
+		for (; m->previous_count; m->previous_count--) push(m->previous[m->previous_count - 1]);
+	}
+
+	bool empty() const {
+		return !std::uint32_t(_head.load(std::memory_order_acquire)) &&
+			!std::uint32_t(_batches.load(std::memory_order_acquire));
+	}
+
+	// Approximate while other threads acquire or release
+	size_t size() const {
+		return _size.load(std::memory_order_relaxed);
+	}
+};
+
+}
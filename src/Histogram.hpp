@@ -0,0 +1,93 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace ByfronUtils {
+
+// Log-linear histogram of unsigned values (HDR style). Every power of two
+// range is split into 2^SUB_BITS linear buckets, so any value is reported
+// with a relative error below 1/2^SUB_BITS. Buckets are added on demand
+// up to the largest value seen. Not synchronized, keep one per thread and
+// merge() them when reporting.
+class Histogram {
+
+public:
+	static const int SUB_BITS = 4;
+	static const std::uint64_t SUB_COUNT = 1 << SUB_BITS;
+
+	Histogram() : _count(0), _min(0), _max(0) {}
+
+	static int bucket(std::uint64_t v) {
+		if (v < SUB_COUNT) return v;
+		int shift = 63 - __builtin_clzll(v) - SUB_BITS;
+		return ((shift + 1) << SUB_BITS) | ((v >> shift) & (SUB_COUNT - 1));
+	}
+
+	// largest value that falls in bucket b
+	static std::uint64_t upper(int b) {
+		if (b < SUB_COUNT) return b;
+		int shift = (b >> SUB_BITS) - 1;
+		std::uint64_t base = (SUB_COUNT | (b & (SUB_COUNT - 1))) << shift;
+		return base + ((std::uint64_t(1) << shift) - 1);
+	}
+
+	void record(std::uint64_t v) {
+		int b = bucket(v);
+		if (b >= _counts.size()) _counts.resize(b + 1, 0);
+		_counts[b]++;
+		if (!_count || v < _min) _min = v;
+		if (v > _max) _max = v;
+		_count++;
+	}
+
+	void merge(const Histogram & other) {
+		if (!other._count) return;
+		if (other._counts.size() > _counts.size())
+			_counts.resize(other._counts.size(), 0);
+		for (int b = 0; b < other._counts.size(); b++)
+			_counts[b] += other._counts[b];
+		if (!_count || other._min < _min) _min = other._min;
+		if (other._max > _max) _max = other._max;
+		_count += other._count;
+	}
+
+	// Value at or below which p percent (0-100) of the values fall,
+	// within the bucket precision and never above max().
+	std::uint64_t percentile(double p) const {
+		if (!_count) return 0;
+
+		std::uint64_t rank = std::uint64_t(p / 100.0 * _count + 0.5);
+		if (rank < 1) rank = 1;
+		if (rank > _count) rank = _count;
+
+		std::uint64_t seen = 0;
+		for (int b = 0; b < _counts.size(); b++) {
+			seen += _counts[b];
+			if (seen >= rank) return upper(b) < _max ? upper(b) : _max;
+		}
+		return _max;
+	}
+
+	std::uint64_t count() const {
+		return _count;
+	}
+
+	std::uint64_t min() const {
+		return _min;
+	}
+
+	std::uint64_t max() const {
+		return _max;
+	}
+
+	void clear() {
+		_counts.clear();
+		_count = _min = _max = 0;
+	}
+
+private:
+	std::vector<std::uint64_t> _counts;
+	std::uint64_t _count, _min, _max;
+};
+
+}
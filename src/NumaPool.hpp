@@ -0,0 +1,297 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <assert.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace ByfronUtils {
+
+// NUMA topology as seen from sysfs and getcpu(). Machines without it look
+// like a single node 0.
+class NumaTopology {
+
+public:
+	// Highest online node + 1
+	static int numNodes() {
+		static int n = readNumNodes();
+		return n;
+	}
+
+	// Node of the CPU the calling thread runs on right now. Always 0 on a
+	// single node; otherwise sched_getcpu(), served from the vDSO, and a
+	// CPU to node table read once.
+	static int currentNode() {
+		if (numNodes() == 1) return 0;
+		static std::vector<int> nodes = readCpuNodes();
+		int cpu = sched_getcpu();
+		return cpu >= 0 && cpu < int(nodes.size()) ? nodes[cpu] : 0;
+	}
+
+	// Anonymous pages bound to node, or just mapped when binding fails
+	static void * allocate(std::size_t bytes, int node) {
+		void * p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) throw std::bad_alloc();
+#ifdef SYS_mbind
+		if (numNodes() > 1 && node < 64) {
+			const int MPOL_PREFERRED = 1;
+			unsigned long mask = 1UL << node;
+			syscall(SYS_mbind, p, bytes, MPOL_PREFERRED, &mask, 64, 0);
+		}
+#endif
+		return p;
+	}
+
+	static void deallocate(void * p, std::size_t bytes) {
+		munmap(p, bytes);
+	}
+
+private:
+	// Numbers in a list like "0", "0-1" or "0,2-3"
+	static std::vector<int> readList(const std::string & path) {
+		std::vector<int> numbers;
+		std::ifstream file(path.c_str());
+		std::string ranges;
+		if (!(file >> ranges)) return numbers;
+
+		int first = -1, value = 0;
+		for (std::size_t i = 0; i <= ranges.size(); i++) {
+			char c = i < ranges.size() ? ranges[i] : ',';
+			if (c >= '0' && c <= '9') value = value * 10 + (c - '0');
+			else if (c == '-') {
+				first = value;
+				value = 0;
+			}
+			else {
+				for (int n = first >= 0 ? first : value; n <= value; n++) numbers.push_back(n);
+				first = -1;
+				value = 0;
+			}
+		}
+		return numbers;
+	}
+
+	static int readNumNodes() {
+		std::vector<int> online = readList("/sys/devices/system/node/online");
+		return online.empty() ? 1 : *std::max_element(online.begin(), online.end()) + 1;
+	}
+
+	// Node of every CPU, 0 for those no node lists
+	static std::vector<int> readCpuNodes() {
+		std::vector<int> nodes;
+		for (int node = 0; node < numNodes(); node++) {
+			std::vector<int> cpus = readList("/sys/devices/system/node/node" +
+							 std::to_string(node) + "/cpulist");
+			for (int cpu : cpus) {
+				if (cpu >= int(nodes.size())) nodes.resize(cpu + 1, 0);
+				nodes[cpu] = node;
+			}
+		}
+		return nodes;
+	}
+};
+
+// Pool with a free list per NUMA node. Objects are built in chunks of
+// memory bound to their node and always go back to that node's list;
+// acquire() takes from the caller's node and steals from the others only
+// when it is empty. On a single node it is a plain locked pool. The pool
+// must outlive the objects it hands out.
+template <typename T>
+class NumaPool {
+
+private:
+	struct Shard;
+
+	struct Node {
+		Node(Shard * s) : next(nullptr), shard(s) {}
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+		Node * next;
+		Shard * shard;
+
+		T * object() { return reinterpret_cast<T *>(&storage); }
+	};
+
+	struct Chunk {
+		void * memory;
+		std::size_t bytes;
+		std::size_t used;
+	};
+
+	struct Shard {
+		Shard() : head(nullptr), size(0) {}
+
+		void push(Node * node) {
+			std::unique_lock<std::mutex> lock(mutex);
+			node->next = head;
+			head = node;
+			size++;
+		}
+
+		Node * pop() {
+			std::unique_lock<std::mutex> lock(mutex);
+			Node * node = head;
+			if (node) {
+				head = node->next;
+				size--;
+			}
+			return node;
+		}
+
+		char pad0[64];
+		std::mutex mutex;
+		Node * head;
+		std::size_t size;
+		std::vector<Chunk> chunks;
+		int node;
+		char pad1[64];
+	};
+
+public:
+
+	static const std::size_t CHUNK_BYTES = 1 << 16;
+
+	// Move-only owner of an acquired object, gives it back to its node
+	class Handle {
+	public:
+		Handle() : _node(nullptr) {}
+		Handle(Handle && other) : _node(other._node) { other._node = nullptr; }
+		~Handle() { reset(); }
+
+		Handle & operator=(Handle && other) {
+			if (this != &other) {
+				reset();
+				_node = other._node;
+				other._node = nullptr;
+			}
+			return *this;
+		}
+
+		T * get() const { return _node ? _node->object() : nullptr; }
+		T & operator*() const { return *_node->object(); }
+		T * operator->() const { return _node->object(); }
+		explicit operator bool() const { return _node != nullptr; }
+
+		// NUMA node the object's memory is on
+		int node() const { return _node->shard->node; }
+
+		void reset() {
+			if (_node) _node->shard->push(_node);
+			_node = nullptr;
+		}
+
+	private:
+		friend class NumaPool<T>;
+		explicit Handle(Node * node) : _node(node) {}
+		Handle(const Handle &);
+		Handle & operator=(const Handle &);
+
+		Node * _node;
+	};
+
+	using PtrType = Handle;
+
+	NumaPool() : _shards(new Shard[NumaTopology::numNodes()]), _steals(0) {
+		for (int n = 0; n < numNodes(); n++) _shards[n].node = n;
+	}
+
+	~NumaPool() {
+		for (int n = 0; n < numNodes(); n++) {
+			for (Chunk & chunk : _shards[n].chunks) {
+				for (std::size_t i = 0; i < chunk.used; i++)
+					static_cast<Node *>(chunk.memory)[i].object()->~T();
+				NumaTopology::deallocate(chunk.memory, chunk.bytes);
+			}
+		}
+	}
+
+	int numNodes() const {
+		return NumaTopology::numNodes();
+	}
+
+	// Builds a free object on the calling thread's node
+	template <typename... Args>
+	void emplace(Args &&... args) {
+		emplaceOn(NumaTopology::currentNode(), std::forward<Args>(args)...);
+	}
+
+	template <typename... Args>
+	void emplaceOn(int node, Args &&... args) {
+		assert(node >= 0 && node < numNodes());
+		Shard & shard = _shards[node];
+		Node * n;
+		{
+			std::unique_lock<std::mutex> lock(shard.mutex);
+			if (shard.chunks.empty() ||
+			    (shard.chunks.back().used + 1) * sizeof(Node) > shard.chunks.back().bytes) {
+				Chunk chunk;
+				chunk.bytes = std::max(CHUNK_BYTES, sizeof(Node));
+				chunk.memory = NumaTopology::allocate(chunk.bytes, node);
+				chunk.used = 0;
+				shard.chunks.push_back(chunk);
+			}
+			Chunk & chunk = shard.chunks.back();
+			n = new (static_cast<Node *>(chunk.memory) + chunk.used) Node(&shard);
+			new (&n->storage) T(std::forward<Args>(args)...);
+			chunk.used++;
+		}
+		shard.push(n);
+	}
+
+	// Prefers the calling thread's node; empty handle when all are empty
+	Handle acquire() {
+		int local = NumaTopology::currentNode();
+		if (Node * node = _shards[local].pop()) return Handle(node);
+
+		for (int i = 1; i < numNodes(); i++) {
+			if (Node * node = _shards[(local + i) % numNodes()].pop()) {
+				_steals.fetch_add(1, std::memory_order_relaxed);
+				return Handle(node);
+			}
+		}
+		return Handle();
+	}
+
+	// Free objects on node
+	std::size_t size(int node) const {
+		std::unique_lock<std::mutex> lock(_shards[node].mutex);
+		return _shards[node].size;
+	}
+
+	std::size_t size() const {
+		std::size_t total = 0;
+		for (int n = 0; n < numNodes(); n++) total += size(n);
+		return total;
+	}
+
+	bool empty() const {
+		return size() == 0;
+	}
+
+	// Acquires served from another node
+	std::uint64_t steals() const {
+		return _steals.load(std::memory_order_relaxed);
+	}
+
+private:
+	NumaPool(const NumaPool &);
+	NumaPool & operator=(const NumaPool &);
+
+	std::unique_ptr<Shard[]> _shards;
+	std::atomic<std::uint64_t> _steals;
+};
+
+template <typename T> const std::size_t NumaPool<T>::CHUNK_BYTES;
+
+}
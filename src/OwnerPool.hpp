@@ -0,0 +1,179 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "ThreadSlot.hpp"
+
+namespace ByfronUtils {
+
+// Pool where every object belongs to the thread that built it (mimalloc
+// style). The owner acquires and releases through a plain thread-local
+// free list. Any other thread releasing an object pushes it with one CAS
+// on the owner's remote list, a line the owner only touches when its
+// local list runs dry and it takes the whole remote list at once.
+//
+// Ownership goes with the thread's ThreadSlot, so a thread that exits
+// leaves its objects to the next thread taking the slot. Threads past
+// ThreadSlot::MAX share one overflow shard behind a mutex. The pool must
+// outlive the objects it hands out.
+template <typename T>
+class OwnerPool {
+
+private:
+	static const std::size_t CHUNK_SIZE = 64;
+
+	struct Shard;
+
+	struct Node {
+		Node() : next(nullptr), owner(nullptr) {}
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+		Node * next;
+		Shard * owner;
+
+		T * object() { return reinterpret_cast<T *>(&storage); }
+	};
+
+	struct Shard {
+		explicit Shard(int s) : slot(s), local(nullptr), used(CHUNK_SIZE),
+					remote(nullptr) {}
+
+		~Shard() {
+			for (std::size_t c = 0; c < chunks.size(); c++) {
+				std::size_t n = c + 1 == chunks.size() ? used : CHUNK_SIZE;
+				for (std::size_t i = 0; i < n; i++) chunks[c][i].object()->~T();
+			}
+		}
+
+		// owner thread only, or under mutex for the overflow shard
+		int slot; // -1 for the overflow shard
+		Node * local;
+		std::vector<std::unique_ptr<Node[]> > chunks;
+		std::size_t used; // nodes built in the last chunk
+
+		std::mutex mutex;
+
+		char pad0[64];
+		std::atomic<Node *> remote; // pushed by other threads
+		char pad1[64];
+	};
+
+	// The calling thread's shard, the overflow one once all slots are taken
+	Shard & shard() {
+		int slot = ThreadSlot::get();
+		if (slot < 0) return _overflow;
+		if (!_shards[slot]) _shards[slot].reset(new Shard(slot));
+		return *_shards[slot];
+	}
+
+	static void release(Node * node) {
+		Shard * owner = node->owner;
+		if (owner->slot < 0) {
+			std::unique_lock<std::mutex> lock(owner->mutex);
+			node->next = owner->local;
+			owner->local = node;
+			return;
+		}
+		if (owner->slot == ThreadSlot::get()) {
+			node->next = owner->local;
+			owner->local = node;
+			return;
+		}
+		Node * head = owner->remote.load(std::memory_order_relaxed);
+		do node->next = head;
+		while (!owner->remote.compare_exchange_weak(head, node, std::memory_order_release,
+							    std::memory_order_relaxed));
+	}
+
+	std::vector<std::unique_ptr<Shard> > _shards;
+	Shard _overflow;
+
+public:
+
+	// Move-only owner of an acquired object, gives it back on destruction
+	class Handle {
+	public:
+		Handle() : _node(nullptr) {}
+		Handle(Handle && other) : _node(other._node) { other._node = nullptr; }
+		~Handle() { reset(); }
+
+		Handle & operator=(Handle && other) {
+			if (this != &other) {
+				reset();
+				_node = other._node;
+				other._node = nullptr;
+			}
+			return *this;
+		}
+
+		T * get() const { return _node ? _node->object() : nullptr; }
+		T & operator*() const { return *_node->object(); }
+		T * operator->() const { return _node->object(); }
+		explicit operator bool() const { return _node != nullptr; }
+
+		void reset() {
+			if (_node) release(_node);
+			_node = nullptr;
+		}
+
+	private:
+		friend class OwnerPool<T>;
+		explicit Handle(Node * node) : _node(node) {}
+		Handle(const Handle &);
+		Handle & operator=(const Handle &);
+
+		Node * _node;
+	};
+
+	using PtrType = Handle;
+
+	OwnerPool() : _shards(ThreadSlot::MAX), _overflow(-1) {}
+
+	// Builds a free object owned by the calling thread
+	template <typename... Args>
+	void emplace(Args &&... args) {
+		Shard & s = shard();
+		std::unique_lock<std::mutex> lock(s.mutex, std::defer_lock);
+		if (s.slot < 0) lock.lock();
+		if (s.used == CHUNK_SIZE) {
+			s.chunks.push_back(std::unique_ptr<Node[]>(new Node[CHUNK_SIZE]));
+			s.used = 0;
+		}
+		Node & node = s.chunks.back()[s.used];
+		new (&node.storage) T(std::forward<Args>(args)...);
+		node.owner = &s;
+		s.used++;
+		if (lock) lock.unlock();
+		release(&node);
+	}
+
+	// One of the calling thread's objects; empty handle when it has none
+	// free, neither locally nor released by other threads
+	Handle acquire() {
+		Shard & s = shard();
+		std::unique_lock<std::mutex> lock(s.mutex, std::defer_lock);
+		if (s.slot < 0) lock.lock();
+		if (!s.local) s.local = s.remote.exchange(nullptr, std::memory_order_acquire);
+		Node * node = s.local;
+		if (!node) return Handle();
+		s.local = node->next;
+		return Handle(node);
+	}
+
+	// Whether the calling thread has a free object in its local list,
+	// without looking at the remote one
+	bool hasLocal() {
+		Shard & s = shard();
+		std::unique_lock<std::mutex> lock(s.mutex, std::defer_lock);
+		if (s.slot < 0) lock.lock();
+		return s.local != nullptr;
+	}
+};
+
+template <typename T> const std::size_t OwnerPool<T>::CHUNK_SIZE;
+
+}
@@ -1,57 +1,806 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <memory>
-#include <queue>
+#include <mutex>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <assert.h>
+#include "Histogram.hpp"
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#else
+#include <condition_variable>
+#endif
 
 namespace ByfronUtils {
-	
+
+// Object pool guarded by a mutex. Every object lives in a node that links
+// it into the free list and points back to its pool, so acquire() and
+// release allocate nothing and the handles are a single pointer. Objects
+// still checked out when the pool is destroyed are deleted by their last
+// handle. Nodes reach the pool through a small block holding its mutex,
+// which lives on until the last node is gone, and the destructor detaches
+// the pool under that mutex, so handles may be released from other
+// threads while the pool is being destroyed.
+//
+// acquireWait() and acquireFor() queue the caller when the pool is empty.
+// A released object goes straight to the oldest waiter, which sleeps on a
+// futex word of its own (a condition variable outside Linux), so only
+// that thread wakes up.
+//
+// Objects given to add() keep their own allocation. Objects built with
+// emplace() are constructed in place in slabs of slab_size objects. A slab
+// is a single aligned allocation with the objects back to back at
+// sizeof(T) stride and their nodes in an array of their own after them, so
+// walking the objects never strides over pool bookkeeping.
+//
+// A pool built with a factory grows by itself following its Policy: in
+// batches up to a cap on objects and bytes, then optionally with unpooled
+// heap objects that are deleted on release. Free objects above the low
+// watermark that stayed unused for a whole idle period are deleted again;
+// the check runs on acquire and release, so only a pool nobody calls keeps
+// them until shrink() forces it.
+//
+// getUsage() counts acquires, releases, misses and the peak of objects out
+// at once, all updated under the lock the pool takes anyway. Hold times
+// cost two clock reads per acquire and go in a histogram once enabled
+// with setHoldTimeTracking().
 template <typename T>
-class Pool : public std::enable_shared_from_this< Pool<T> >{
+class Pool {
 
 private:
-	struct ExternalDeleter {
-		explicit ExternalDeleter(std::weak_ptr<Pool<T> > pool)
-			: m_pool(pool) {}
+	struct Slab;
+
+	// Shared by the pool and its nodes, freed with the last of them
+	struct Core {
+		explicit Core(Pool<T> * p) : pool(p), refs(1) {}
+		std::mutex mutex;  // the pool's
+		Pool<T> * pool;    // nullptr once the pool is gone
+		std::atomic<std::size_t> refs;
+
+		void unref() {
+			if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+		}
+	};
+
+	struct Node {
+		Node(Core * c, T * t, Slab * s) : object(t), next(nullptr), core(c), slab(s),
+						  index(0), acquired(0), refs(0) {
+			if (core) core->refs.fetch_add(1, std::memory_order_relaxed);
+		}
+		T * object;
+		Node * next;
+		Core * core;       // nullptr when never pooled
+		Slab * slab;       // nullptr for heap objects
+		std::size_t index; // in m_nodes, heap objects only
+		std::uint64_t acquired; // ns, while hold times are tracked
+		std::atomic<std::uint32_t> refs; // shared handles only
+	};
+
+	typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Storage;
 
-		void operator()(T* ptr) {
-			if (auto pool_ptr = m_pool.lock()) {
-				try {
-					(pool_ptr->add(std::unique_ptr<T>(ptr)));
-					return;
-				} catch(...) {}
+	// Freed by the last of its objects to be destroyed
+	struct Slab {
+		explicit Slab(std::size_t capacity)
+			: memory(new char[alignof(Storage) + capacity * sizeof(Storage) + alignof(Node) + capacity * sizeof(Node)]),
+			  used(0), live(0) {
+			char * p = align(memory.get(), alignof(Storage));
+			objects = reinterpret_cast<Storage *>(p);
+			nodes = reinterpret_cast<Node *>(align(p + capacity * sizeof(Storage), alignof(Node)));
+		}
+
+		static char * align(char * p, std::size_t alignment) {
+			std::size_t offset = reinterpret_cast<std::uintptr_t>(p) % alignment;
+			return offset ? p + alignment - offset : p;
+		}
+
+		std::unique_ptr<char[]> memory;
+		Storage * objects;
+		Node * nodes; // of the objects at the same index
+		std::size_t used;
+		std::atomic<std::size_t> live;
+	};
+
+	static void destroy(Node * node) {
+		Core * core = node->core;
+		Slab * slab = node->slab;
+		if (!slab) {
+			delete node->object;
+			delete node;
+		}
+		else {
+			node->object->~T();
+			node->~Node();
+			if (slab->live.fetch_sub(1, std::memory_order_acq_rel) == 1) delete slab;
+		}
+		if (core) core->unref();
+	}
+
+	// Lives on the stack of a thread blocked in wait()
+	struct Waiter {
+		Waiter() : node(nullptr), next(nullptr), ready(0) {}
+		Node * node;
+		Waiter * next;
+		std::atomic<int> ready;
+#ifndef __linux__
+		std::condition_variable wake; // waited on with the pool's mutex
+#endif
+	};
+
+#ifdef __linux__
+	static_assert(sizeof(std::atomic<int>) == sizeof(int), "futex word");
+
+	static void futexWait(std::atomic<int> * word, const timespec * timeout) {
+		syscall(SYS_futex, reinterpret_cast<int *>(word), FUTEX_WAIT_PRIVATE, 0, timeout, nullptr, 0);
+	}
+
+	// FUTEX_WAKE never reads the word, so the waiter may already be gone
+	static void futexWake(std::atomic<int> * word) {
+		syscall(SYS_futex, reinterpret_cast<int *>(word), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+	}
+#endif
+
+	// Wakes a waiter handOff() gave an object to, with or without the lock
+	static void wake(Waiter * waiter) {
+#ifdef __linux__
+		futexWake(&waiter->ready);
+#endif
+	}
+
+	static void release(Node * node) {
+		if (Core * core = node->core) {
+			std::unique_lock<std::mutex> lock(core->mutex);
+			if (core->pool) {
+				core->pool->give(node, true, lock);
+				return;
 			}
-			std::default_delete<T>{}(ptr);
 		}
-	private:
-		std::weak_ptr<Pool<T> > m_pool;
+		destroy(node);
+	}
+
+	static std::uint64_t now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Accounts for node being handed out, under the lock
+	void checkout(Node * node) {
+		m_usage.acquires++;
+		m_usage.outstanding++;
+		if (m_usage.outstanding > m_usage.peak) m_usage.peak = m_usage.outstanding;
+		if (m_hold_times) node->acquired = now();
+	}
+
+	// Hands node to the oldest waiter or puts it back in the free list,
+	// returned when it comes back from a handle
+	void give(Node * node, bool returned) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		give(node, returned, lock);
+	}
+
+	// Same with the lock held, releases it
+	void give(Node * node, bool returned, std::unique_lock<std::mutex> & lock) {
+		if (returned) checkin(node);
+		Waiter * waiter = m_waiters;
+		if (!waiter) {
+			push(node);
+			Node * idle = trimIdle();
+			lock.unlock();
+			destroyList(idle);
+			return;
+		}
+		handOff(node);
+		lock.unlock();
+		wake(waiter);
+	}
+
+	// Accounts for node coming back from a handle, under the lock
+	void checkin(Node * node) {
+		m_usage.releases++;
+		m_usage.outstanding--;
+		if (node->acquired) m_usage.hold_time.record(now() - node->acquired);
+		node->acquired = 0;
+	}
+
+	// Gives node to the oldest waiter, under the lock. Wake it up next.
+	void handOff(Node * node) {
+		Waiter * waiter = m_waiters;
+		m_waiters = waiter->next;
+		if (!m_waiters) m_waiters_tail = nullptr;
+		m_num_waiting--;
+		checkout(node);
+		waiter->node = node;
+		waiter->ready.store(1, std::memory_order_release);
+#ifndef __linux__
+		// under the lock, as the waiter only leaves holding it
+		waiter->wake.notify_one();
+#endif
+	}
+
+	// Blocks until an object is handed over, or until deadline if given
+	Node * wait(const std::chrono::steady_clock::time_point * deadline) {
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if (m_head) return take(lock);
+			m_usage.misses++;
+		}
+		if (Node * node = grow()) return node;
+
+		Waiter waiter;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if (m_head) return take(lock);
+			if (deadline && std::chrono::steady_clock::now() >= *deadline) return nullptr;
+			if (m_waiters_tail) m_waiters_tail->next = &waiter;
+			else m_waiters = &waiter;
+			m_waiters_tail = &waiter;
+			m_num_waiting++;
+		}
+
+#ifdef __linux__
+		while (!waiter.ready.load(std::memory_order_acquire)) {
+			timespec ts, * timeout = nullptr;
+			if (deadline) {
+				auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(
+					*deadline - std::chrono::steady_clock::now()).count();
+				if (left <= 0) break;
+				ts.tv_sec = left / 1000000000;
+				ts.tv_nsec = left % 1000000000;
+				timeout = &ts;
+			}
+			futexWait(&waiter.ready, timeout);
+		}
+		if (waiter.ready.load(std::memory_order_acquire)) return waiter.node;
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+#else
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (!waiter.ready.load(std::memory_order_relaxed)) {
+			if (!deadline) waiter.wake.wait(lock);
+			else if (waiter.wake.wait_until(lock, *deadline) == std::cv_status::timeout) break;
+		}
+#endif
+
+		// timed out, unless an object arrived meanwhile
+		if (waiter.ready.load(std::memory_order_relaxed)) return waiter.node;
+		Waiter * prev = nullptr;
+		for (Waiter * w = m_waiters; w != &waiter; w = w->next) prev = w;
+		if (prev) prev->next = waiter.next;
+		else m_waiters = waiter.next;
+		if (m_waiters_tail == &waiter) m_waiters_tail = prev;
+		m_num_waiting--;
+		return nullptr;
+	}
+
+	void push(Node * node) {
+		if (m_policy.order == LIFO) {
+			node->next = m_head;
+			m_head = node;
+			if (!m_tail) m_tail = node;
+		}
+		else {
+			node->next = nullptr;
+			if (m_tail) m_tail->next = node;
+			else m_head = node;
+			m_tail = node;
+		}
+		m_size++;
+	}
+
+	Node * pop() {
+		Node * node = m_head;
+		m_head = node->next;
+		if (!m_head) m_tail = nullptr;
+		m_size--;
+		if (m_size < m_min_free) m_min_free = m_size;
+		return node;
+	}
+
+	Node * take() {
+		Node * node = pop();
+		checkout(node);
+		return node;
+	}
+
+	// Takes a free object, then deletes the idle ones outside the lock
+	Node * take(std::unique_lock<std::mutex> & lock) {
+		Node * node = take();
+		Node * idle = trimIdle();
+		lock.unlock();
+		destroyList(idle);
+		return node;
+	}
+
+	// Creates up to a batch of objects the policy allows, outside the lock,
+	// and returns one of them (or an unpooled one as fallback)
+	Node * grow() {
+		if (!m_factory) return nullptr;
+
+		std::size_t n = 0;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			std::size_t limit = m_policy.max_objects;
+			bool capped = limit != 0;
+			if (m_policy.max_bytes) {
+				// a budget below one object allows none
+				std::size_t by_bytes = m_policy.max_bytes / m_policy.object_bytes;
+				if (!capped || by_bytes < limit) limit = by_bytes;
+				capped = true;
+			}
+			n = m_policy.grow_batch;
+			if (capped) n = m_total < limit ? std::min(n, limit - m_total) : 0;
+			m_total += n;
+			if (!n && m_policy.heap_fallback) {
+				m_usage.acquires++;
+				m_usage.fallbacks++;
+			}
+		}
+
+		if (!n) return m_policy.heap_fallback ? heapNode(nullptr) : nullptr;
+
+		// the batch is reserved up front; what the factory fails to build
+		// is given back, and the caller only sees the exception when not
+		// even its own object got built
+		Node * first = nullptr;
+		std::size_t built = 0;
+		try {
+			for (; built < n; built++) {
+				Node * node = heapNode(m_core);
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+					node->index = m_nodes.size();
+					m_nodes.push_back(node);
+					if (!first) {
+						first = node;
+						checkout(node);
+						continue;
+					}
+				}
+				give(node, false);
+			}
+		}
+		catch (...) {
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_total -= n - built;
+			}
+			if (!first) throw;
+		}
+		return first;
+	}
+
+	Node * heapNode(Core * core) {
+		std::unique_ptr<T> object = m_factory();
+		Node * node = new Node(core, object.get(), nullptr);
+		object.release();
+		return node;
+	}
+
+	// Idle objects to delete when the policy trims by itself, under the lock
+	Node * trimIdle() {
+		return m_policy.idle_time.count() ? trim(false) : nullptr;
+	}
+
+	// Unlinks free heap objects down to the low watermark, only those that
+	// stayed free for the idle period unless forced. Returns them chained.
+	Node * trim(bool force) {
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (!force && now - m_last_trim < m_policy.idle_time) return nullptr;
+
+		std::size_t excess = m_size > m_policy.low_watermark ? m_size - m_policy.low_watermark : 0;
+		if (!force && m_min_free < excess) excess = m_min_free;
+
+		// the coldest objects are at the head in FIFO order, at the tail in LIFO
+		std::size_t skip = m_policy.order == LIFO ? m_size - excess : 0;
+
+		Node * removed = nullptr;
+		Node * prev = nullptr;
+		for (Node * node = m_head; node && excess; ) {
+			Node * next = node->next;
+			if (node->slab || skip) {
+				prev = node;
+				if (skip) skip--;
+			}
+			else {
+				if (prev) prev->next = next;
+				else m_head = next;
+				if (m_tail == node) m_tail = prev;
+				m_nodes[node->index] = m_nodes.back();
+				m_nodes[node->index]->index = node->index;
+				m_nodes.pop_back();
+				node->next = removed;
+				removed = node;
+				m_size--;
+				m_total--;
+				excess--;
+			}
+			node = next;
+		}
+		m_min_free = m_size;
+		m_last_trim = now;
+		return removed;
+	}
+
+	static void destroyList(Node * node) {
+		while (node) {
+			Node * next = node->next;
+			destroy(node);
+			node = next;
+		}
+	}
+
+	Core * m_core;
+	std::mutex & m_mutex; // in m_core, guards all below
+	Node * m_head; // free objects, next to be acquired first
+	Node * m_tail;
+	size_t m_size;
+	size_t m_min_free;   // since m_last_trim
+	size_t m_total;      // objects owned, free or not
+	std::vector<Node *> m_nodes; // heap objects
+	std::vector<Slab *> m_slabs;
+	std::size_t m_slab_size;
+	Waiter * m_waiters; // oldest first
+	Waiter * m_waiters_tail;
+	size_t m_num_waiting;
+
+public:
+
+	struct Usage {
+		Usage() : acquires(0), releases(0), misses(0), fallbacks(0), outstanding(0), peak(0) {}
+
+		std::uint64_t acquires;
+		std::uint64_t releases;
+		std::uint64_t misses;    // acquires that found no free object
+		std::uint64_t fallbacks; // unpooled objects handed out
+		std::size_t outstanding; // pooled objects out now
+		std::size_t peak;
+		Histogram hold_time;     // ns, while tracked
+
+		// Acquires served from free objects, in percent
+		double hitRate() const {
+			return acquires ? 100.0 * (acquires - std::min(misses, acquires)) / acquires : 100.0;
+		}
+
+		// Label and value pairs, as taken by Profiler::addCounterSource()
+		std::vector<std::pair<std::string, double> > values() const {
+			std::vector<std::pair<std::string, double> > v;
+			v.push_back(std::make_pair("Acquires", double(acquires)));
+			v.push_back(std::make_pair("Hit %", hitRate()));
+			v.push_back(std::make_pair("Misses", double(misses)));
+			v.push_back(std::make_pair("Out", double(outstanding)));
+			v.push_back(std::make_pair("Peak", double(peak)));
+			if (hold_time.count()) {
+				v.push_back(std::make_pair("Hold p50 ms", hold_time.percentile(50.0) * 1e-6));
+				v.push_back(std::make_pair("Hold p99 ms", hold_time.percentile(99.0) * 1e-6));
+				v.push_back(std::make_pair("Hold max ms", hold_time.max() * 1e-6));
+			}
+			return v;
+		}
 	};
 
-	std::queue<std::unique_ptr<T> > m_pool;
+private:
+	Usage m_usage;
+	bool m_hold_times;
 
 public:
 
-	using PtrType = std::unique_ptr<T, ExternalDeleter>;	
+	typedef std::function<std::unique_ptr<T>()> Factory;
+
+	// FIFO hands out the object idle the longest, LIFO the one released
+	// last, which is the most likely to still be in cache
+	enum Order {
+		FIFO,
+		LIFO
+	};
+
+	struct Policy {
+		Policy() : grow_batch(1), max_objects(0), max_bytes(0), object_bytes(sizeof(T)),
+			   heap_fallback(false), low_watermark(0), idle_time(0), order(FIFO) {}
+
+		std::size_t grow_batch;   // objects created at once when empty
+		std::size_t max_objects;  // 0 for no cap
+		std::size_t max_bytes;    // 0 for no budget
+		std::size_t object_bytes; // charged per object against max_bytes
+		bool heap_fallback;       // hand out unpooled objects past the caps
+		std::size_t low_watermark;
+		std::chrono::milliseconds idle_time; // 0 never shrinks by itself
+		Order order;
+	};
+
+private:
+	Factory m_factory;
+	Policy m_policy;
+	std::chrono::steady_clock::time_point m_last_trim;
+
+public:
+
+	class SharedHandle;
+
+	// Move-only owner of an acquired object, gives it back on destruction
+	class Handle {
+	public:
+		Handle() : _node(nullptr) {}
+		Handle(Handle && other) : _node(other._node) { other._node = nullptr; }
+		~Handle() { reset(); }
+
+		Handle & operator=(Handle && other) {
+			if (this != &other) {
+				reset();
+				_node = other._node;
+				other._node = nullptr;
+			}
+			return *this;
+		}
+
+		T * get() const { return _node ? _node->object : nullptr; }
+		T & operator*() const { return *_node->object; }
+		T * operator->() const { return _node->object; }
+		explicit operator bool() const { return _node != nullptr; }
+
+		void reset() {
+			if (_node) release(_node);
+			_node = nullptr;
+		}
+
+	private:
+		friend class Pool<T>;
+		friend class SharedHandle;
+		explicit Handle(Node * node) : _node(node) {}
+		Handle(const Handle &);
+		Handle & operator=(const Handle &);
+
+		Node * _node;
+	};
+
+	// Copyable handle counting its references in the node; the object goes
+	// back to the pool with the last copy
+	class SharedHandle {
+	public:
+		SharedHandle() : _node(nullptr) {}
+		SharedHandle(Handle && handle) : _node(handle._node) {
+			handle._node = nullptr;
+			if (_node) _node->refs.store(1, std::memory_order_relaxed);
+		}
+		SharedHandle(const SharedHandle & other) : _node(other._node) {
+			if (_node) _node->refs.fetch_add(1, std::memory_order_relaxed);
+		}
+		~SharedHandle() { reset(); }
+
+		SharedHandle & operator=(SharedHandle other) {
+			std::swap(_node, other._node);
+			return *this;
+		}
+
+		T * get() const { return _node ? _node->object : nullptr; }
+		T & operator*() const { return *_node->object; }
+		T * operator->() const { return _node->object; }
+		explicit operator bool() const { return _node != nullptr; }
+
+		std::uint32_t useCount() const {
+			return _node ? _node->refs.load(std::memory_order_relaxed) : 0;
+		}
+
+		void reset() {
+			if (_node && _node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				release(_node);
+			_node = nullptr;
+		}
+
+	private:
+		Node * _node;
+	};
+
+	using PtrType = Handle;
+
+	static const std::size_t DEFAULT_SLAB_SIZE = 64;
+
+	explicit Pool(std::size_t slab_size = DEFAULT_SLAB_SIZE, Order order = FIFO)
+		: m_core(new Core(this)), m_mutex(m_core->mutex), m_head(nullptr), m_tail(nullptr), m_size(0), m_min_free(0), m_total(0),
+		  m_slab_size(slab_size), m_waiters(nullptr), m_waiters_tail(nullptr),
+		  m_num_waiting(0), m_hold_times(false), m_last_trim(std::chrono::steady_clock::now()) {
+		assert(slab_size > 0);
+		m_policy.order = order;
+	}
+
+	explicit Pool(Order order) : Pool(DEFAULT_SLAB_SIZE, order) {}
 
-	Pool() {}
+	// Grows with factory as policy allows
+	explicit Pool(Factory factory, const Policy & policy = Policy()) : Pool() {
+		assert(factory && policy.grow_batch > 0 && policy.object_bytes > 0);
+		m_factory = std::move(factory);
+		m_policy = policy;
+	}
+
+	// No thread may still be waiting. Handles released from now on delete
+	// their objects.
+	~Pool() {
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			assert(!m_waiters);
+			m_core->pool = nullptr;
+		}
+		for (Slab * slab : m_slabs)
+			if (!slab->used) delete slab; // the constructor threw
+		while (m_head) destroy(pop());
+		m_core->unref();
+	}
 
 	void add(std::unique_ptr<T> t) {
-		m_pool.push(std::move(t));
+		Node * node = new Node(m_core, t.release(), nullptr);
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			node->index = m_nodes.size();
+			m_nodes.push_back(node);
+			m_total++;
+		}
+		give(node, false);
 	}
-	
-	std::shared_ptr<T> acquire() {
-		assert(!m_pool.empty());
-		std::shared_ptr<T> tmp(m_pool.front().release(), ExternalDeleter(this->shared_from_this()));	       
-		m_pool.pop();
-		return std::move(tmp);
+
+	// Builds a new free object in the current slab, starting a slab when full
+	template <typename... Args>
+	void emplace(Args &&... args) {
+		Node * node;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if (m_slabs.empty() || m_slabs.back()->used == m_slab_size)
+				m_slabs.push_back(new Slab(m_slab_size));
+			Slab * slab = m_slabs.back();
+			T * object = new (&slab->objects[slab->used]) T(std::forward<Args>(args)...);
+			node = new (&slab->nodes[slab->used]) Node(m_core, object, slab);
+			slab->used++;
+			slab->live.fetch_add(1, std::memory_order_relaxed);
+			m_total++;
+		}
+		give(node, false);
+	}
+
+	// Asserts when no object is free and the policy allows no more
+	Handle acquire() {
+		Handle handle = tryAcquire();
+		assert(handle);
+		return handle;
+	}
+
+	// Empty handle when no object is free and the policy allows no more
+	Handle tryAcquire() {
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if (m_head) return Handle(take(lock));
+			m_usage.misses++;
+		}
+		return Handle(grow());
+	}
+
+	// Writes up to n handles to out and returns how many. Takes the lock
+	// once for the free objects, then grows for the rest as the policy
+	// allows; never waits.
+	template <typename OutputIt>
+	std::size_t acquireN(OutputIt out, std::size_t n) {
+		std::size_t k = 0;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			for (; k < n && m_head; k++) *out++ = Handle(take());
+			if (k < n) m_usage.misses++;
+			Node * idle = trimIdle();
+			lock.unlock();
+			destroyList(idle);
+		}
+		while (k < n) {
+			Node * node = grow();
+			if (!node) break;
+			*out++ = Handle(node);
+			k++;
+			std::unique_lock<std::mutex> lock(m_mutex);
+			for (; k < n && m_head; k++) *out++ = Handle(take());
+		}
+		return k;
+	}
+
+	// Gives back every handle in [first, last) under a single lock, empty
+	// handles and those of other pools aside
+	template <typename Iterator>
+	void releaseN(Iterator first, Iterator last) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		for (; first != last; ++first) {
+			Node * node = first->_node;
+			if (!node) continue;
+			if (node->core != m_core) {
+				lock.unlock();
+				first->reset();
+				lock.lock();
+				continue;
+			}
+			first->_node = nullptr;
+			checkin(node);
+			if (!m_waiters) {
+				push(node);
+				continue;
+			}
+			// rare enough to wake the waiter under the lock
+			Waiter * waiter = m_waiters;
+			handOff(node);
+			wake(waiter);
+		}
+		Node * idle = trimIdle();
+		lock.unlock();
+		destroyList(idle);
+	}
+
+	// Blocks until an object is free
+	Handle acquireWait() {
+		return Handle(wait(nullptr));
+	}
+
+	// Empty handle if no object came free within timeout
+	template <typename Rep, typename Period>
+	Handle acquireFor(const std::chrono::duration<Rep, Period> & timeout) {
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+			std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout);
+		return Handle(wait(&deadline));
 	}
 
 	bool empty() const {
-		return m_pool.empty();
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_head == nullptr;
 	}
 
 	size_t size() const {
-		return m_pool.size();
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_size;
+	}
+
+	// Objects owned by the pool, free or checked out
+	size_t total() const {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_total;
+	}
+
+	// Deletes free heap objects down to the low watermark now
+	void shrink() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		Node * removed = trim(true);
+		lock.unlock();
+		destroyList(removed);
+	}
+
+	Usage getUsage() const {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_usage;
 	}
-	
+
+	// Starts counting again, from the objects out now
+	void clearUsage() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		std::size_t outstanding = m_usage.outstanding;
+		m_usage = Usage();
+		m_usage.outstanding = m_usage.peak = outstanding;
+	}
+
+	// Objects out when enabled are not timed
+	void setHoldTimeTracking(bool enable) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_hold_times = enable;
+	}
+
+	// Threads blocked in acquireWait() or acquireFor()
+	size_t waiting() const {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		return m_num_waiting;
+	}
+
+private:
+	Pool(const Pool &);
+	Pool & operator=(const Pool &);
 };
 
 
@@ -0,0 +1,317 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+#include <assert.h>
+#include "ThreadSlot.hpp"
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define BYFRON_HAS_PMR 1
+#endif
+#endif
+
+namespace ByfronUtils {
+
+// Free list of fixed-size raw blocks: a free block holds the link to the
+// next one. Blocks are carved lazily from 64 KB chunks that are only freed
+// with the pool. This is not Pool's free list, which links constructed
+// objects through nodes of their own; raw blocks can carry the link
+// themselves.
+//
+// With a cache size, every thread also keeps up to that many free blocks
+// of its own and moves half of them to or from the shared list, under the
+// mutex, only when its cache runs empty or full, like the magazines of
+// ConcurrentPool. Cached blocks stay with a thread's slot after it exits
+// until another thread takes the slot; call flush() before a thread exits
+// to hand them back.
+class BlockPool {
+
+public:
+	static const std::size_t CHUNK_BYTES = 1 << 16;
+
+	// block_size is rounded up to hold a link, cache_size 0 leaves out the
+	// thread caches
+	explicit BlockPool(std::size_t block_size, std::size_t cache_size = 0)
+		: _block_size(block_size < sizeof(Free) ? sizeof(Free) : block_size), _cache_size(cache_size),
+		  _free(nullptr), _bump(nullptr), _end(nullptr) {
+		if (_cache_size) _caches.resize(ThreadSlot::MAX);
+	}
+
+	void * allocate() {
+		Cache * c = cache();
+		if (!c) {
+			std::unique_lock<std::mutex> lock(_mutex);
+			return take();
+		}
+		if (!c->count) refill(*c);
+		Free * block = c->head;
+		c->head = block->next;
+		c->count--;
+		return block;
+	}
+
+	void deallocate(void * p) {
+		Free * block = static_cast<Free *>(p);
+		Cache * c = cache();
+		if (!c) {
+			std::unique_lock<std::mutex> lock(_mutex);
+			block->next = _free;
+			_free = block;
+			return;
+		}
+		if (c->count == _cache_size) spill(*c, _cache_size - batch());
+		block->next = c->head;
+		c->head = block;
+		c->count++;
+	}
+
+	// Hands the calling thread's cached blocks back to the shared list
+	void flush() {
+		Cache * c = cache();
+		if (c && c->count) spill(*c, 0);
+	}
+
+	std::size_t blockSize() const {
+		return _block_size;
+	}
+
+private:
+	BlockPool(const BlockPool &);
+	BlockPool & operator=(const BlockPool &);
+
+	struct Free {
+		Free * next;
+	};
+
+	// Owned by one thread slot
+	struct Cache {
+		Cache() : head(nullptr), count(0) {}
+		Free * head;
+		std::size_t count;
+		char padding[64];
+	};
+
+	Cache * cache() {
+		if (!_cache_size) return nullptr;
+		int slot = ThreadSlot::get();
+		if (slot < 0) return nullptr;
+		if (!_caches[slot]) _caches[slot].reset(new Cache());
+		return _caches[slot].get();
+	}
+
+	std::size_t batch() const {
+		return _cache_size > 1 ? _cache_size / 2 : 1;
+	}
+
+	// A free block, carved from the current chunk when none is, under the lock
+	Free * take() {
+		if (_free) {
+			Free * block = _free;
+			_free = block->next;
+			return block;
+		}
+		if (_bump + _block_size > _end) {
+			std::size_t bytes = CHUNK_BYTES;
+			if (bytes < _block_size) bytes = _block_size;
+			_chunks.push_back(std::unique_ptr<char[]>(new char[bytes]));
+			_bump = _chunks.back().get();
+			_end = _bump + bytes;
+		}
+		Free * block = reinterpret_cast<Free *>(_bump);
+		_bump += _block_size;
+		return block;
+	}
+
+	// Fills an empty cache with a batch, in the order they were taken
+	void refill(Cache & c) {
+		std::size_t n = batch();
+		Free * tail = nullptr;
+		std::unique_lock<std::mutex> lock(_mutex);
+		for (std::size_t i = 0; i < n; i++) {
+			Free * block = take();
+			block->next = nullptr;
+			if (tail) tail->next = block;
+			else c.head = block;
+			tail = block;
+		}
+		c.count = n;
+	}
+
+	// Moves all but the keep most recently cached blocks to the shared list
+	void spill(Cache & c, std::size_t keep) {
+		Free * last = nullptr;
+		Free * first = c.head;
+		for (std::size_t i = 0; i < keep; i++) {
+			last = first;
+			first = first->next;
+		}
+		Free * tail = first;
+		while (tail->next) tail = tail->next;
+
+		if (last) last->next = nullptr;
+		else c.head = nullptr;
+		c.count = keep;
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		tail->next = _free;
+		_free = first;
+	}
+
+	std::size_t _block_size;
+	std::size_t _cache_size;
+	std::vector<std::unique_ptr<Cache> > _caches;
+	std::mutex _mutex; // guards all below
+	Free * _free;
+	char * _bump;
+	char * _end;
+	std::vector<std::unique_ptr<char[]> > _chunks;
+};
+
+// Memory resource made of one BlockPool per size class, for the small
+// allocations of node-based containers. Every thread caches about
+// CACHE_BYTES of free blocks per class, so threads sharing the resource
+// rarely meet on a class mutex. Requests above MAX_BLOCK bytes or aligned
+// past 16 bytes go to the heap. deallocate() must get the same size and
+// alignment as allocate().
+class PoolResource {
+
+public:
+	static const std::size_t MAX_BLOCK = 512;
+	static const std::size_t MAX_ALIGN = 16;
+	static const std::size_t CACHE_BYTES = 1 << 12;
+
+	PoolResource() {
+		static const std::size_t sizes[] = {8, 16, 32, 48, 64, 80, 96, 112, 128,
+						    160, 192, 224, 256, 320, 384, 448, 512};
+		for (std::size_t size : sizes)
+			_classes.push_back(std::unique_ptr<BlockPool>(new BlockPool(size, CACHE_BYTES / size)));
+
+		// first class holding each multiple of 8 bytes
+		std::size_t c = 0;
+		for (std::size_t i = 0; i <= MAX_BLOCK / 8; i++) {
+			while (sizes[c] < i * 8) c++;
+			_lookup[i] = c;
+		}
+	}
+
+	// Shared by default-constructed PoolAllocators
+	static PoolResource & shared() {
+		static PoolResource r;
+		return r;
+	}
+
+	void * allocate(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t)) {
+		BlockPool * pool = classFor(bytes, alignment);
+		if (pool) return pool->allocate();
+
+		void * p = nullptr;
+		if (posix_memalign(&p, alignment < sizeof(void *) ? sizeof(void *) : alignment, bytes ? bytes : 1))
+			throw std::bad_alloc();
+		return p;
+	}
+
+	void deallocate(void * p, std::size_t bytes, std::size_t alignment = alignof(std::max_align_t)) {
+		BlockPool * pool = classFor(bytes, alignment);
+		if (pool) pool->deallocate(p);
+		else free(p);
+	}
+
+	// Hands the calling thread's cached blocks back, see BlockPool::flush()
+	void flush() {
+		for (auto & pool : _classes) pool->flush();
+	}
+
+	// Block size serving bytes at alignment, 0 when it goes to the heap
+	std::size_t blockSize(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t)) {
+		BlockPool * pool = classFor(bytes, alignment);
+		return pool ? pool->blockSize() : 0;
+	}
+
+private:
+	PoolResource(const PoolResource &);
+	PoolResource & operator=(const PoolResource &);
+
+	// Blocks sit at multiples of their size from a 16 byte aligned chunk,
+	// so a class whose size is a multiple of the alignment keeps it
+	BlockPool * classFor(std::size_t bytes, std::size_t alignment) {
+		if (bytes > MAX_BLOCK || alignment > MAX_ALIGN) return nullptr;
+		for (std::size_t c = _lookup[(bytes + 7) / 8]; c < _classes.size(); c++)
+			if (_classes[c]->blockSize() % alignment == 0) return _classes[c].get();
+		return nullptr;
+	}
+
+	std::vector<std::unique_ptr<BlockPool> > _classes;
+	std::size_t _lookup[MAX_BLOCK / 8 + 1];
+};
+
+// STL allocator drawing from a PoolResource, the shared one by default
+template <typename T>
+class PoolAllocator {
+
+public:
+	typedef T value_type;
+
+	PoolAllocator() : _resource(&PoolResource::shared()) {}
+	explicit PoolAllocator(PoolResource * resource) : _resource(resource) {}
+
+	template <typename U>
+	PoolAllocator(const PoolAllocator<U> & other) : _resource(other.resource()) {}
+
+	T * allocate(std::size_t n) {
+		return static_cast<T *>(_resource->allocate(n * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T * p, std::size_t n) {
+		_resource->deallocate(p, n * sizeof(T), alignof(T));
+	}
+
+	PoolResource * resource() const {
+		return _resource;
+	}
+
+private:
+	PoolResource * _resource;
+};
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T> & a, const PoolAllocator<U> & b) {
+	return a.resource() == b.resource();
+}
+
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T> & a, const PoolAllocator<U> & b) {
+	return a.resource() != b.resource();
+}
+
+#ifdef BYFRON_HAS_PMR
+// std::pmr view of a PoolResource, for pmr containers (C++17)
+class PmrPoolResource : public std::pmr::memory_resource {
+
+public:
+	explicit PmrPoolResource(PoolResource & resource = PoolResource::shared()) : _resource(resource) {}
+
+private:
+	void * do_allocate(std::size_t bytes, std::size_t alignment) override {
+		return _resource.allocate(bytes, alignment);
+	}
+
+	void do_deallocate(void * p, std::size_t bytes, std::size_t alignment) override {
+		_resource.deallocate(p, bytes, alignment);
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource & other) const noexcept override {
+		const PmrPoolResource * r = dynamic_cast<const PmrPoolResource *>(&other);
+		return r && &r->_resource == &_resource;
+	}
+
+	PoolResource & _resource;
+};
+#endif
+
+}
@@ -7,78 +7,311 @@
 #include <algorithm>
 #include <mutex>
 #include <thread>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <atomic>
+#include <sstream>
+#include <condition_variable>
+#include <functional>
 #include <assert.h>
+#include <time.h>
+
+#include "Histogram.hpp"
+#include "SpscRing.hpp"
+#include "TraceFile.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#include <cpuid.h>
+#define BYFRON_HAS_TSC 1
+#else
+#define BYFRON_HAS_TSC 0
+#endif
+
+#ifdef __linux__
+#include <linux/membarrier.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <string.h>
+#endif
 
 #define ROOT_ID 0
 
-#define __PROF(x) Profiler profile_##x(#x);
+// Defining BYFRON_PROFILER_DISABLE before including this header turns every
+// __PROF scope into an empty NullProfiler that the optimizer removes.
+#ifdef BYFRON_PROFILER_DISABLE
+#define __PROF(x) ByfronUtils::NullProfiler profile_##x; (void)profile_##x;
+#define __STOP(x) (void)profile_##x;
+#else
+#define __PROF(x) static const ByfronUtils::Profiler::Site profile_site_##x(#x, __FILE__, __LINE__, \
+	std::integral_constant<std::uint64_t, ByfronUtils::Profiler::hash(#x)>::value); \
+	ByfronUtils::Profiler profile_##x(profile_site_##x);
 #define __STOP(x) profile_##x.stop();
+#endif
 
 namespace ByfronUtils {
 
-typedef std::chrono::time_point<std::chrono::high_resolution_clock> time_point_t;
+// Clock policies for the Profiler. now() returns raw ticks, which are only
+// converted to nanoseconds with ns_per_tick() when stats are reported.
 
-class Profiler {
+class SteadyClock {
+public:
+	static std::uint64_t now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	static double ns_per_tick() {
+		return 1.0;
+	}
+};
 
+// Reads the invariant TSC, calibrated once against steady_clock. Falls back
+// to CLOCK_MONOTONIC nanoseconds when the TSC is missing or not invariant.
+class TscClock {
 public:
-	typedef std::string Key;
+	static std::uint64_t now() {
+#if BYFRON_HAS_TSC
+		if (invariant()) {
+			unsigned int aux;
+			return __rdtscp(&aux);
+		}
+#endif
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return std::uint64_t(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+	}
 
+	static double ns_per_tick() {
+		static const double ratio = calibrate();
+		return ratio;
+	}
 
-	static time_point_t get_time() {
-		return std::chrono::high_resolution_clock::now();
+	static bool invariant() {
+		static const bool inv = detect_invariant();
+		return inv;
 	}
 
+private:
+	static bool detect_invariant() {
+#if BYFRON_HAS_TSC
+		unsigned int eax, ebx, ecx, edx;
+		if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+			return edx & (1 << 8);
+#endif
+		return false;
+	}
 
-	static double ns2ms(double nseconds) {
-		std::chrono::duration<double, std::nano> ns(nseconds);
-		return std::chrono::duration_cast<std::chrono::milliseconds>(ns).count();
+	static double calibrate() {
+		if (!invariant()) return 1.0;
+
+		typedef std::chrono::steady_clock clock;
+		clock::time_point t0 = clock::now();
+		std::uint64_t c0 = now();
+		while (clock::now() - t0 < std::chrono::milliseconds(20)) {}
+		clock::time_point t1 = clock::now();
+		std::uint64_t c1 = now();
+
+		double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+		return c1 > c0 ? ns / (c1 - c0) : 1.0;
 	}
+};
 
-	class KeyMap {
-	public:
+// Group of per-thread hardware counters read through perf_event_open. open()
+// fails quietly when the kernel refuses access (perf_event_paranoid,
+// seccomp, no PMU), and the Profiler then records time only.
+class PerfCounters {
+public:
+	enum Counter {
+		CYCLES,
+		INSTRUCTIONS,
+		LLC_MISSES,
+		BRANCH_MISSES,
+		NUM_COUNTERS
+	};
 
-		typedef std::map<Key, std::map< std::size_t, int> >::iterator  iter;
+	PerfCounters() : _tried(false) {
+		for (int i = 0; i < NUM_COUNTERS; i++) _fds[i] = -1;
+	}
 
-		void clear() {
-			_map.clear();
-		}
+	~PerfCounters() {
+		close();
+	}
 
-		bool exists(Key k) {
-			if (_map.count(k))
-				return true;
+	// Opens the group for the calling thread, only tried once
+	bool open() {
+		if (_tried) return valid();
+		_tried = true;
+#ifdef __linux__
+		static const std::uint64_t configs[NUM_COUNTERS] = {
+			PERF_COUNT_HW_CPU_CYCLES,
+			PERF_COUNT_HW_INSTRUCTIONS,
+			PERF_COUNT_HW_CACHE_MISSES,
+			PERF_COUNT_HW_BRANCH_MISSES
+		};
 
-			return false;
+		for (int i = 0; i < NUM_COUNTERS; i++) {
+			perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.size = sizeof(attr);
+			attr.config = configs[i];
+			attr.disabled = i == 0;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_GROUP;
+
+			_fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, i ? _fds[0] : -1, 0);
+			if (_fds[i] < 0) {
+				close();
+				return false;
+			}
 		}
 
-		bool exists(Key k, std::size_t tid) {
-			if (_map.count(k))
-				if (_map[k].count(tid)) return true;
+		ioctl(_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		return true;
+#else
+		return false;
+#endif
+	}
 
-			return false;
-		}
+	bool valid() const {
+		return _fds[0] >= 0;
+	}
 
-		iter begin() {
-			return _map.begin();
-		}
+	bool read(std::uint64_t values[NUM_COUNTERS]) {
+#ifdef __linux__
+		struct {
+			std::uint64_t nr;
+			std::uint64_t values[NUM_COUNTERS];
+		} group;
+		if (::read(_fds[0], &group, sizeof(group)) != sizeof(group)) return false;
+		for (int i = 0; i < NUM_COUNTERS; i++) values[i] = group.values[i];
+		return true;
+#else
+		return false;
+#endif
+	}
 
-		iter end() {
-			return _map.end();
+	// Leaves the group closed for good, open() will not retry
+	void close() {
+		_tried = true;
+#ifdef __linux__
+		for (int i = NUM_COUNTERS - 1; i >= 0; i--) {
+			if (_fds[i] >= 0) ::close(_fds[i]);
+			_fds[i] = -1;
 		}
+#endif
+	}
 
-		int & operator[](Key k) {
-			std::hash<std::thread::id> hasher;
-			std::size_t tid = hasher(std::this_thread::get_id());
-			return _map[k][tid];
-		}
+private:
+	int _fds[NUM_COUNTERS];
+	bool _tried;
+};
 
-		int & get(Key k, std::size_t thread_id) {
-			return _map[k][thread_id];
-		}
+// Fence pair for a flag handshake between a frequent and a rare side.
+// light() is a compiler fence once membarrier() is available, and heavy()
+// then forces a full fence on every thread of the process, so of two
+// threads each storing its flag, fencing and loading the other's, one
+// always sees the other. Without membarrier both are full fences.
+class AsymmetricFence {
+public:
+	static void light() {
+		if (expedited()) std::atomic_signal_fence(std::memory_order_seq_cst);
+		else std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
 
-	private:
-		std::map<Key, std::map< std::size_t, int> > _map;
+	static void heavy() {
+#if defined(__linux__) && defined(MEMBARRIER_CMD_PRIVATE_EXPEDITED)
+		if (expedited() && syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0) == 0) return;
+#endif
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+
+private:
+	static bool expedited() {
+		static const bool e = registerExpedited();
+		return e;
+	}
+
+	static bool registerExpedited() {
+#if defined(__linux__) && defined(MEMBARRIER_CMD_PRIVATE_EXPEDITED)
+		return syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0;
+#else
+		return false;
+#endif
+	}
+};
+
+#ifndef BYFRON_PROFILER_CLOCK
+#define BYFRON_PROFILER_CLOCK SteadyClock
+#endif
+
+typedef BYFRON_PROFILER_CLOCK ProfilerClock;
+
+// What __PROF expands to when profiling is compiled out
+class NullProfiler {
+public:
+	void stop() {}
+};
+
+typedef std::uint64_t time_point_t;
+
+class Profiler {
+
+public:
+	typedef std::string Key;
+
+
+	static time_point_t get_time() {
+		return ProfilerClock::now();
+	}
+
+	static double ticks2ns(double ticks) {
+		return ticks * ProfilerClock::ns_per_tick();
+	}
+
+
+	static double ns2ms(double nseconds) {
+		std::chrono::duration<double, std::nano> ns(nseconds);
+		return std::chrono::duration_cast<std::chrono::milliseconds>(ns).count();
+	}
+
+	// FNV-1a, usable in constant expressions
+	static constexpr std::uint64_t hash(const char * s,
+					    std::uint64_t h = 14695981039346656037ULL) {
+		return *s ? hash(s + 1, (h ^ std::uint64_t(std::uint8_t(*s))) * 1099511628211ULL) : h;
+	}
+
+	// One static instance per __PROF call site. Sites sharing a name share
+	// the same id, which indexes the per-thread slot tables directly.
+	class Site {
+	public:
+		Site(const char * n, const char * f, int l, std::uint64_t h)
+			: name(n), file(f), line(l), hash(h), id(Profiler::intern(n, h)) {}
+		const char * name;
+		const char * file;
+		int line;
+		std::uint64_t hash;
+		int id;
 	};
 
+	// A scope begin ('B') or end ('E'), kept while event recording is on
+	// and queued to the aggregator thread while it runs
+	struct Event {
+		Event() {}
+		Event(time_point_t t, int k, char ph) : time(t), key_id(k), phase(ph) {}
+		time_point_t time;
+		int key_id;
+		char phase;
+	};
 
 	enum SortingMode {
 		TOTAL_ELAPSED,
@@ -88,58 +321,56 @@ public:
 
 	class Stats {
 	public:
-		Stats() {}
+		Stats() : start(0), finish(0), ticks(0), total(0), count(0), paralel(false), parent(-1), thread_id(0), key_id(-1), counted(0) {
+			std::fill(counters, counters + PerfCounters::NUM_COUNTERS, 0);
+		}
 		Stats(Key k, time_point_t s, int p, std::size_t tid) : key(k),
 								 start(s),
-								 parent(p),
+								 finish(s),
+								 ticks(0),
+								 total(0),
 								 count(1),
 								 paralel(false),
-								 thread_id(tid) {}
-		time_point_t start, finish;
+								 parent(p),
+								 thread_id(tid),
+								 key_id(-1),
+								 counted(0) {
+			std::fill(counters, counters + PerfCounters::NUM_COUNTERS, 0);
+		}
 		Key key;
+		time_point_t start, finish;
+		std::uint64_t ticks;
 		double total;
 		long count;
 	        bool paralel;
 		int parent;
 		std::size_t thread_id;
+		int key_id;
+		Histogram histogram; // per call durations, in clock ticks
+		std::uint64_t counters[PerfCounters::NUM_COUNTERS];
+		long counted; // calls that have hardware counter deltas
 
-		double nanoseconds_elapsed() {
-			return std::chrono::duration_cast<std::chrono::nanoseconds>(finish-start).count();
+		double nanoseconds_elapsed() const {
+			return ticks2ns(finish - start);
 		}
-	};
-
-	Profiler(const Key & key) : _key(key), _running(true) {
 
-		std::unique_lock<std::mutex> lock(profile_mutex());
-
-		std::hash<std::thread::id> hasher;
-		std::size_t tid = hasher(std::this_thread::get_id());
-
-		if (!Profiler::keymap().exists("__root__")) {
-			Profiler::stats().push_back(Stats("__root__", get_time(), -1, tid));
-			Profiler::stats()[0].finish = get_time();
-			Profiler::keymap()["__root__"] = 0;
+		double ipc() const {
+			if (!counters[PerfCounters::CYCLES]) return 0;
+			return double(counters[PerfCounters::INSTRUCTIONS]) / counters[PerfCounters::CYCLES];
 		}
 
-		if (keymap().exists(key, tid)) {
-			int id = keymap().get(_key, tid);
-			Profiler::stats()[id].count++;
-			Profiler::hierarchy()[tid].push(id);
-			//assert should have the same parent
-		}
-		else {
-			int id = Profiler::stats().size();
-			keymap().get(_key,tid) = id;
-			int parent = 0;
-			if (hierarchy()[tid].size() > 0) parent = Profiler::hierarchy()[tid].top();
-			Profiler::stats().push_back(Stats(key,
-							  get_time(),
-							  parent,
-							  tid));
-			Profiler::hierarchy()[tid].push(id);
+		double perCall(PerfCounters::Counter c) const {
+			return counted ? double(counters[c]) / counted : 0;
 		}
+	};
+
+	Profiler(const Site & site) : _running(true) {
+		start(site.id);
+	}
 
-		Profiler::stats()[keymap().get(_key, tid)].start = get_time();
+	// Interns key on every call, prefer __PROF in hot code
+	Profiler(const Key & key) : _running(true) {
+		start(intern(key.c_str(), hash(key.c_str())));
 	}
 
 	~Profiler() {
@@ -151,23 +382,31 @@ public:
 		if(not _running) return;
 
 		time_point_t end_time = get_time();
+		_running = false;
 
-		std::unique_lock<std::mutex> lock(profile_mutex());
-
-		//TODO refactor
-		std::hash<std::thread::id> hasher;
-		std::size_t tid = hasher(std::this_thread::get_id());
-		Stats & s = Profiler::stats()[keymap()[_key]];
-		Profiler::hierarchy()[tid].pop();
+		ThreadData & td = *_td;
+		if (tracing().load(std::memory_order_relaxed))
+			td.trace(end_time, _key_id, true);
 
-		s.finish = end_time;
-		s.total += s.nanoseconds_elapsed();
-		if (end_time > Profiler::stats()[ROOT_ID].finish) {
-			Profiler::stats()[ROOT_ID].finish = end_time;
-			Profiler::stats()[ROOT_ID].total = Profiler::stats()[ROOT_ID].nanoseconds_elapsed();
+		if (_queued) {
+			td.push(Event(end_time, _key_id, 'E'));
+			return;
 		}
 
-		_running = false;
+		RecordGuard guard(td);
+
+		// the thread's records were cleared while this scope was open
+		if (_generation != td.generation) return;
+
+		leave(td, _id, end_time);
+
+		Stats & s = td.stats[_id];
+		std::uint64_t counters[PerfCounters::NUM_COUNTERS];
+		if (_counting && td.perf.read(counters)) {
+			for (int i = 0; i < PerfCounters::NUM_COUNTERS; i++)
+				s.counters[i] += counters[i] - _counters[i];
+			s.counted++;
+		}
 	}
 
 	static std::vector<Stats> sortStats(const SortingMode mode, const std::vector<Stats> stats) {
@@ -210,36 +449,40 @@ public:
 	static std::vector<Stats> getFusedStats() {
 
 		std::map<Key, Stats> key_stats;
-		std::map<int,int> oldnewmapping;
-		std::map<Key, int> old_idx;
+		std::map<Key, Key> parent_key;
 
 		//accumulate times per key
-		int idx = 0;
-		for (auto s : stats()) {
+		std::vector<Stats> all = collectStats();
+		for (auto & s : all) {
 			Key key = s.key;
 			if (!key_stats.count(key)) {
 				key_stats[key] = s;
-				old_idx[key] = idx;
+				if (s.parent >= 0) parent_key[key] = all[s.parent].key;
 			}
 			else {
 				key_stats[key].count += s.count;
 				key_stats[key].paralel = true;
-				key_stats[key].total += s.nanoseconds_elapsed();
+				key_stats[key].total += s.total;
+				key_stats[key].histogram.merge(s.histogram);
+				for (int i = 0; i < PerfCounters::NUM_COUNTERS; i++)
+					key_stats[key].counters[i] += s.counters[i];
+				key_stats[key].counted += s.counted;
 			}
-			idx++;
 		}
 
-		int count = 0;
-		for (auto idx : old_idx) {
-			oldnewmapping[idx.second] = count;
-			count++;
+		// parents are remapped by key, as the record a key first
+		// appeared under needs not be its parent's first record
+		std::map<Key, int> fused_index;
+		for (auto & s : key_stats) {
+			int index = fused_index.size();
+			fused_index[s.first] = index;
 		}
 
 		std::vector<Stats> fstats;
 		for (auto s : key_stats) {
 			Stats fs = s.second;
 			if (fs.parent >= 0)
-				fs.parent = oldnewmapping[fs.parent];
+				fs.parent = fused_index[parent_key[s.first]];
 
 			fstats.push_back(fs);
 		}
@@ -252,7 +495,7 @@ public:
 	}
 
 	static long getNumCalls(Key key) {
-		return getNumCalls(stats()[keymap()[key]]);
+		return getNumCalls(getStats(key));
 	}
 
 	static double getTimeInMilis(Stats s) {
@@ -260,49 +503,651 @@ public:
 	}
 
 	static double getTimeInMilis(Key key) {
-		assert(keymap().exists(key));
-		return getTimeInMilis(stats()[keymap()[key]]);
+		return getTimeInMilis(getStats(key));
+	}
+
+	// Duration under which p percent (0-100) of the calls finished, in
+	// fractional milliseconds
+	static double getPercentileInMilis(Stats s, double p) {
+		return ticks2ns(s.histogram.percentile(p)) / 1e6;
+	}
+
+	static double getPercentileInMilis(Key key, double p) {
+		return getPercentileInMilis(getStats(key), p);
+	}
+
+	static double getMaxInMilis(Stats s) {
+		return ticks2ns(s.histogram.max()) / 1e6;
+	}
+
+	static double getMaxInMilis(Key key) {
+		return getMaxInMilis(getStats(key));
 	}
 
 	static void clear() {
 
+		std::unique_lock<std::mutex> drain_lock(drain_mutex());
+		drain();
 		std::unique_lock<std::mutex> lock(profile_mutex());
 
-		stats().clear();
-		keymap().clear();
-		for (auto hpid : hierarchy()) {
-			while (!hpid.second.empty() )
-			{
-				hpid.second.pop();
-			}
+		for (auto & td : threads()) {
+			AccessGuard guard(*td);
+			td->generation++;
+			td->stats.clear();
+			std::fill(td->slots.begin(), td->slots.end(), -1);
+			td->hierarchy.clear();
+			td->events.clear();
+			td->started = false;
+			td->last_finish = time_point_t();
 		}
 	}
 
+	typedef std::vector<std::pair<std::string, double> > Counters;
+	typedef std::function<Counters()> CounterSource;
+
+	// Adds a table to print() with the values source returns at report
+	// time, e.g. a pool's getUsage().values(). The id removes it again.
+	static int addCounterSource(const Key & name, CounterSource source) {
+		std::unique_lock<std::mutex> lock(profile_mutex());
+		int id = next_counter_source()++;
+		counter_sources()[id] = std::make_pair(name, source);
+		return id;
+	}
+
+	static void removeCounterSource(int id) {
+		std::unique_lock<std::mutex> lock(profile_mutex());
+		counter_sources().erase(id);
+	}
+
+	// Samples every source, outside the Profiler lock
+	static std::vector<std::pair<Key, Counters> > getCounters() {
+		std::vector<std::pair<Key, CounterSource> > sources;
+		{
+			std::unique_lock<std::mutex> lock(profile_mutex());
+			for (auto & s : counter_sources()) sources.push_back(s.second);
+		}
+		std::vector<std::pair<Key, Counters> > counters;
+		for (auto & s : sources) counters.push_back(std::make_pair(s.first, s.second()));
+		return counters;
+	}
+
 	static std::map<int, Key> getInverseMap() {
 		std::map<int, Key>  idToKey;
-		for (auto k : keymap()) {
-			for (auto t : k.second)
-				idToKey[t.second] = k.first;
-		}
+		std::vector<Stats> all = collectStats();
+		for (int i = 0; i < all.size(); i++)
+			idToKey[i] = all[i].key;
 		return idToKey;
 	}
 
 private:
 
-	Key _key;
+	typedef SpscRing<Event> EventRing;
+	static const std::size_t RING_SIZE = 1 << 15;
+	static const std::size_t TRACE_CHUNKS = 8;
+
+	// A thread's binary trace chunks. They cycle between the thread
+	// (current), the writer (full) and back (free), so memory is bounded
+	// and allocated once. Events that find no free chunk are dropped.
+	struct TraceBuffer {
+		TraceBuffer(std::uint32_t thread) : current(nullptr), full(TRACE_CHUNKS),
+						    free(TRACE_CHUNKS), dropped(0) {
+			for (int i = 0; i < TRACE_CHUNKS; i++) {
+				chunks.push_back(std::unique_ptr<TraceChunk>(new TraceChunk(thread)));
+				free.push(chunks.back().get());
+			}
+		}
+
+		// owning thread only, never waits
+		void append(time_point_t time, int key_id, bool end) {
+			if (!current && !free.pop(current)) {
+				dropped.store(dropped.load(std::memory_order_relaxed) + 1,
+					      std::memory_order_relaxed);
+				return;
+			}
+
+			current->append(time, key_id, end);
+			if (!current->full()) return;
+
+			if (full.push(current)) {
+				current = nullptr;
+			}
+			else {
+				dropped.store(dropped.load(std::memory_order_relaxed) + current->count(),
+					      std::memory_order_relaxed);
+				current->reset();
+			}
+		}
+
+		TraceChunk * current;
+		SpscRing<TraceChunk *> full, free;
+		std::vector<std::unique_ptr<TraceChunk> > chunks;
+		std::atomic<std::uint64_t> dropped;
+	};
+
+	// Everything a thread records lives here. The thread writes it without
+	// locking: it raises `recording` with a plain store around each scope's
+	// bookkeeping and only backs off while `accessing` is up. Reports,
+	// clear() and drains raise `accessing`, fence every thread and wait for
+	// the bookkeeping in flight, so they only ever cost the recording thread
+	// a wait while they run. Cache line aligned, so the hot fields of two
+	// threads never share a line.
+	struct alignas(64) ThreadData {
+		ThreadData(std::size_t tid, std::uint32_t idx) : thread_id(tid), index(idx), started(false),
+								 first_start(), last_finish(), generation(0),
+								 ring(nullptr), trace_buffer(nullptr),
+								 recording(false), accessing(false) {}
+		~ThreadData() {
+			delete ring.load();
+			delete trace_buffer.load();
+		}
+
+		// new does not honour alignas before C++17
+		static void * operator new(std::size_t size) {
+			void * p = nullptr;
+			if (posix_memalign(&p, alignof(ThreadData), size)) throw std::bad_alloc();
+			return p;
+		}
+
+		static void operator delete(void * p) {
+			free(p);
+		}
+
+		// Owning thread only
+		void beginRecord() {
+			for (;;) {
+				recording.store(true, std::memory_order_relaxed);
+				AsymmetricFence::light();
+				if (!accessing.load(std::memory_order_acquire)) return;
+				recording.store(false, std::memory_order_release);
+				while (accessing.load(std::memory_order_acquire)) std::this_thread::yield();
+			}
+		}
+
+		void endRecord() {
+			recording.store(false, std::memory_order_release);
+		}
+
+		// Any thread, exclusive of the owner's bookkeeping and of each other
+		void beginAccess() {
+			mutex.lock();
+			accessing.store(true, std::memory_order_relaxed);
+			AsymmetricFence::heavy();
+			while (recording.load(std::memory_order_acquire)) std::this_thread::yield();
+		}
+
+		void endAccess() {
+			accessing.store(false, std::memory_order_release);
+			mutex.unlock();
+		}
+
+		void trace(time_point_t time, int key_id, bool end) {
+			TraceBuffer * b = trace_buffer.load(std::memory_order_relaxed);
+			if (!b) {
+				b = new TraceBuffer(index);
+				trace_buffer.store(b, std::memory_order_release);
+			}
+			b->append(time, key_id, end);
+		}
+
+		// Queues an event for the aggregator, waiting for room when the
+		// ring is full. Only called by the owning thread.
+		void push(const Event & e) {
+			EventRing * r = ring.load(std::memory_order_relaxed);
+			if (!r) {
+				r = new EventRing(RING_SIZE);
+				ring.store(r, std::memory_order_release);
+			}
+			while (!r->push(e)) {
+				if (aggregating().load()) {
+					aggregator().wake.notify_one();
+					std::this_thread::yield();
+				}
+				else {
+					std::unique_lock<std::mutex> lock(drain_mutex());
+					drain(*this);
+				}
+			}
+		}
+
+		std::mutex mutex; // between the threads accessing the records
+		std::size_t thread_id;
+		std::uint32_t index;
+		std::vector<Stats> stats;
+		std::vector<int> slots;
+		std::vector<int> hierarchy;
+		std::vector<Event> events;
+		PerfCounters perf;
+		bool started;
+		time_point_t first_start, last_finish;
+		std::uint32_t generation; // bumped by clear()
+		std::atomic<EventRing *> ring;
+		std::atomic<TraceBuffer *> trace_buffer;
+		std::atomic<bool> recording;
+		std::atomic<bool> accessing;
+	};
+
+	struct RecordGuard {
+		explicit RecordGuard(ThreadData & t) : td(t) { td.beginRecord(); }
+		~RecordGuard() { td.endRecord(); }
+		ThreadData & td;
+	};
+
+	struct AccessGuard {
+		explicit AccessGuard(ThreadData & t) : td(t) { td.beginAccess(); }
+		~AccessGuard() { td.endAccess(); }
+		ThreadData & td;
+	};
+
 	bool _running;
+	std::size_t _id;
+	ThreadData * _td;
+	bool _counting;
+	std::uint64_t _counters[PerfCounters::NUM_COUNTERS];
+	bool _queued;
+	int _key_id;
+	std::uint32_t _generation;
+
+	void start(int key_id) {
+
+		ThreadData & td = thread_data();
+		_td = &td;
+		_key_id = key_id;
+
+		_queued = aggregating().load(std::memory_order_relaxed);
+		if (_queued) {
+			time_point_t start_time = get_time();
+			if (tracing().load(std::memory_order_relaxed))
+				td.trace(start_time, key_id, false);
+			td.push(Event(start_time, key_id, 'B'));
+			return;
+		}
+
+		RecordGuard guard(td);
+		_generation = td.generation;
+		_id = enter(td, key_id);
+
+		_counting = counting().load(std::memory_order_relaxed) &&
+			td.perf.open() && td.perf.read(_counters);
+
+		time_point_t start_time = get_time();
+		if (tracing().load(std::memory_order_relaxed))
+			td.trace(start_time, key_id, false);
+		begin(td, _id, start_time);
+	}
+
+	// Bookkeeping of a scope entry, returns its record index
+	static int enter(ThreadData & td, int key_id) {
+
+		int id;
+		if (key_id >= td.slots.size())
+			td.slots.resize(key_id + 1, -1);
+
+		int & slot = td.slots[key_id];
+		if (slot >= 0) {
+			id = slot;
+			td.stats[id].count++;
+			//assert should have the same parent
+		}
+		else {
+			id = slot = td.stats.size();
+			int parent = td.hierarchy.empty() ? -1 : td.hierarchy.back();
+			td.stats.push_back(Stats(Key(), time_point_t(), parent, td.thread_id));
+			td.stats[id].key_id = key_id;
+		}
+		td.hierarchy.push_back(id);
+		return id;
+	}
+
+	static void begin(ThreadData & td, int id, time_point_t start_time) {
+
+		if (!td.started) {
+			td.first_start = start_time;
+			td.started = true;
+		}
+		td.stats[id].start = start_time;
+		if (recording_events().load(std::memory_order_relaxed))
+			td.events.push_back(Event(start_time, td.stats[id].key_id, 'B'));
+	}
+
+	static void leave(ThreadData & td, int id, time_point_t end_time) {
+
+		if (!td.hierarchy.empty()) td.hierarchy.pop_back();
+
+		Stats & s = td.stats[id];
+		if (recording_events().load(std::memory_order_relaxed))
+			td.events.push_back(Event(end_time, s.key_id, 'E'));
+
+		s.finish = end_time;
+		s.ticks += end_time - s.start;
+		s.histogram.record(end_time - s.start);
+		if (end_time > td.last_finish) td.last_finish = end_time;
+	}
+
+	// Replays the events queued by td's thread into its records
+	static void drain(ThreadData & td) {
+
+		EventRing * ring = td.ring.load(std::memory_order_acquire);
+		if (!ring) return;
+
+		AccessGuard guard(td);
+		Event e;
+		while (ring->pop(e)) {
+			if (e.phase == 'B') {
+				begin(td, enter(td, e.key_id), e.time);
+			}
+			else if (e.key_id < td.slots.size() && td.slots[e.key_id] >= 0) {
+				leave(td, td.slots[e.key_id], e.time);
+			}
+		}
+	}
+
+	// Drains every thread, the caller holds drain_mutex()
+	static void drain() {
+
+		std::vector<ThreadData *> tds;
+		{
+			std::unique_lock<std::mutex> lock(profile_mutex());
+			for (auto & td : threads()) tds.push_back(td.get());
+		}
+		for (auto td : tds) drain(*td);
+	}
+
+	static void flush() {
+		std::unique_lock<std::mutex> lock(drain_mutex());
+		drain();
+	}
+
+	struct Aggregator {
+		~Aggregator() {
+			stop();
+		}
+
+		void start(std::chrono::microseconds period) {
+			std::unique_lock<std::mutex> lock(drain_mutex());
+			if (aggregating().load()) return;
+
+			aggregating().store(true);
+			thread = std::thread(&Aggregator::run, this, period);
+		}
+
+		void stop() {
+			{
+				std::unique_lock<std::mutex> lock(drain_mutex());
+				aggregating().store(false);
+				wake.notify_one();
+			}
+			if (thread.joinable()) thread.join();
+			flush();
+		}
+
+		void run(std::chrono::microseconds period) {
+			std::unique_lock<std::mutex> lock(drain_mutex());
+			while (aggregating().load()) {
+				drain();
+				wake.wait_for(lock, period);
+			}
+		}
+
+		std::thread thread;
+		std::condition_variable wake;
+	};
+
+	// id of name, allocating one the first time the name is seen
+	static int intern(const char * name, std::uint64_t h) {
+
+		std::unique_lock<std::mutex> lock(profile_mutex());
+
+		auto range = key_ids().equal_range(h);
+		for (auto it = range.first; it != range.second; ++it) {
+			if (key_names()[it->second] == name) return it->second;
+		}
+
+		int id = key_names().size();
+		key_names().push_back(name);
+		key_ids().insert(std::make_pair(h, id));
+		return id;
+	}
 
+	// id of name or -1, never allocates one
+	static int find(const Key & key) {
+
+		std::unique_lock<std::mutex> lock(profile_mutex());
+
+		auto range = key_ids().equal_range(hash(key.c_str()));
+		for (auto it = range.first; it != range.second; ++it) {
+			if (key_names()[it->second] == key) return it->second;
+		}
+		return -1;
+	}
+
+	// guards the thread and key registries, never taken on the recording path
 	static std::mutex & profile_mutex() { static std::mutex m; return m; }
-	static std::map<std::size_t, std::stack<int> > & hierarchy() {
-		static std::map<std::size_t, std::stack<int> > h; return h; }
-	static std::vector<Stats> & stats() { static std::vector<Stats> s; return s; }
-	static KeyMap & keymap() { static KeyMap k; return k; }
+	// serializes the consumers of the event rings, taken before profile_mutex()
+	static std::mutex & drain_mutex() { static std::mutex m; return m; }
+	static std::atomic<bool> & aggregating() { static std::atomic<bool> a(false); return a; }
+	static std::atomic<bool> & tracing() { static std::atomic<bool> t(false); return t; }
+	static Aggregator & aggregator() {
+		// constructed after the registries it drains, so destroyed before them
+		threads(); key_names(); profile_mutex(); drain_mutex();
+		static Aggregator a; return a;
+	}
+	static std::multimap<std::uint64_t, int> & key_ids() {
+		static std::multimap<std::uint64_t, int> k; return k; }
+	static std::vector<Key> & key_names() { static std::vector<Key> n; return n; }
+	static std::atomic<bool> & recording_events() { static std::atomic<bool> r(false); return r; }
+	static std::atomic<bool> & counting() { static std::atomic<bool> c(false); return c; }
+	static std::map<int, std::pair<Key, CounterSource> > & counter_sources() {
+		static std::map<int, std::pair<Key, CounterSource> > c; return c; }
+	static int & next_counter_source() { static int n = 0; return n; }
+	static std::vector<std::unique_ptr<ThreadData> > & threads() {
+		static std::vector<std::unique_ptr<ThreadData> > t; return t; }
+
+	// Drains the thread's queued events, hands its partial trace chunk to
+	// the writer and closes its hardware counters when it exits; the
+	// ThreadData itself stays for the reports
+	struct ThreadExit {
+		ThreadExit(ThreadData * t) : td(t) {}
+		~ThreadExit() {
+			td->perf.close();
+
+			TraceBuffer * b = td->trace_buffer.load();
+			if (b && b->current && !b->current->empty() && b->full.push(b->current))
+				b->current = nullptr;
+
+			if (!td->ring.load()) return;
+			std::unique_lock<std::mutex> lock(drain_mutex());
+			drain(*td);
+		}
+		ThreadData * td;
+	};
+
+	struct TraceWriter {
+		TraceWriter() : file(nullptr), running(false), names(0) {}
+		~TraceWriter() {
+			stop();
+		}
+
+		bool start(const std::string & filename) {
+			std::unique_lock<std::mutex> lock(mutex);
+			if (file) return false;
+
+			file = fopen(filename.c_str(), "wb");
+			if (!file) return false;
+
+			TraceFormat::writeHeader(file, ProfilerClock::ns_per_tick());
+			names = 0;
+			running = true;
+			tracing().store(true);
+			thread = std::thread(&TraceWriter::run, this);
+			return true;
+		}
+
+		void stop() {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				if (!file) return;
+				tracing().store(false);
+				running = false;
+				wake.notify_one();
+			}
+			thread.join();
+
+			std::unique_lock<std::mutex> lock(mutex);
+			write(true);
+			fclose(file);
+			file = nullptr;
+		}
+
+		void run() {
+			std::unique_lock<std::mutex> lock(mutex);
+			while (running) {
+				write(false);
+				wake.wait_for(lock, std::chrono::milliseconds(1));
+			}
+		}
+
+		// Writes the full chunks of every thread, and their partial
+		// chunks once tracing has stopped
+		void write(bool partial) {
+
+			std::vector<ThreadData *> tds;
+			{
+				std::unique_lock<std::mutex> lock(profile_mutex());
+				for (auto & td : threads()) tds.push_back(td.get());
+			}
+
+			std::vector<std::pair<TraceBuffer *, TraceChunk *> > chunks;
+			for (auto td : tds) {
+				TraceBuffer * b = td->trace_buffer.load(std::memory_order_acquire);
+				if (!b) continue;
+
+				TraceChunk * c;
+				while (b->full.pop(c)) chunks.push_back(std::make_pair(b, c));
+				if (partial && b->current && !b->current->empty()) {
+					chunks.push_back(std::make_pair(b, b->current));
+					b->current = nullptr;
+				}
+			}
+
+			// every key in the popped chunks is interned by now
+			{
+				std::unique_lock<std::mutex> lock(profile_mutex());
+				for (; names < key_names().size(); names++)
+					TraceFormat::writeName(file, names, key_names()[names]);
+			}
+
+			for (auto & bc : chunks) {
+				bc.second->write(file);
+				bc.second->reset();
+				bc.first->free.push(bc.second);
+			}
+			fflush(file);
+		}
+
+		FILE * file;
+		bool running;
+		std::size_t names;
+		std::thread thread;
+		std::mutex mutex;
+		std::condition_variable wake;
+	};
+
+	static TraceWriter & trace_writer() {
+		// constructed after the registries it reads, so destroyed before them
+		threads(); key_names(); profile_mutex();
+		static TraceWriter w; return w;
+	}
+
+	static ThreadData & thread_data() {
+		static thread_local ThreadData * td = nullptr;
+		if (!td) {
+			// calibrate before anything is timed
+			ProfilerClock::ns_per_tick();
+
+			std::hash<std::thread::id> hasher;
+			std::unique_lock<std::mutex> lock(profile_mutex());
+			threads().push_back(std::unique_ptr<ThreadData>(
+				new ThreadData(hasher(std::this_thread::get_id()), threads().size())));
+			td = threads().back().get();
+			lock.unlock();
+
+			static thread_local ThreadExit exit_hook(td);
+		}
+		return *td;
+	}
+
+	// Merges the per-thread records into one vector laid out as
+	// [__root__, thread 0 records, thread 1 records, ...] with parent
+	// indices pointing into it. Threads that exit keep their records.
+	static std::vector<Stats> collectStats() {
+
+		flush();
+		std::unique_lock<std::mutex> lock(profile_mutex());
+
+		// totals are kept in clock ticks until now
+		std::vector<Stats> all;
+		Stats root("__root__", time_point_t(), -1, 0);
+		bool started = false;
+		for (auto & td : threads()) {
+			AccessGuard guard(*td);
+			if (!td->started) continue;
+			if (!started || td->first_start < root.start) {
+				root.start = td->first_start;
+				root.thread_id = td->thread_id;
+			}
+			if (!started || td->last_finish > root.finish)
+				root.finish = td->last_finish;
+			started = true;
+		}
+
+		if (!started) return all;
+
+		if (root.finish < root.start) root.finish = root.start;
+		root.total = root.nanoseconds_elapsed();
+		root.histogram.record(root.finish - root.start);
+		all.push_back(root);
+
+		for (auto & td : threads()) {
+			AccessGuard guard(*td);
+			int offset = all.size();
+			for (auto s : td->stats) {
+				s.key = key_names()[s.key_id];
+				s.total = ticks2ns(s.ticks);
+				s.parent = s.parent < 0 ? ROOT_ID : s.parent + offset;
+				all.push_back(s);
+			}
+		}
+
+		return all;
+	}
+
+	// Stats of the calling thread for key, or the merged root
+	static Stats getStats(const Key & key) {
+
+		if (key == "__root__") {
+			std::vector<Stats> all = collectStats();
+			assert(!all.empty());
+			return all[ROOT_ID];
+		}
+
+		int key_id = find(key);
+		flush();
+		ThreadData & td = thread_data();
+		AccessGuard guard(td);
+		assert(key_id >= 0 && key_id < td.slots.size() && td.slots[key_id] >= 0);
+		Stats s = td.stats[td.slots[key_id]];
+		s.key = key;
+		s.total = ticks2ns(s.ticks);
+		return s;
+	}
 
 	class ConsolePrinter {
 
 	public:
 		ConsolePrinter() {
 			_colWidth = 20;
+			_numCols = 8;
+			_counters = false;
 		}
 
 		struct Node {
@@ -333,14 +1178,14 @@ private:
 		}
 
 		void printTopLine() {
-			for (int j = 0; j < 4; j++) {
+			for (int j = 0; j < _numCols; j++) {
 				for (int i = 0; i < _colWidth; i++)
 					std::cout << "=";
 				std::cout << "|";
 			}
 		}
 		void printBottomLine() {
-			for (int i = 0; i < _colWidth*4 + 4; i++)
+			for (int i = 0; i < _colWidth*_numCols + _numCols; i++)
 				std::cout << "=";
 		}
 
@@ -357,7 +1202,7 @@ private:
 			printcol(name);
 
 			char col[100];
-			sprintf(col, "%d/%c (%03.3f ms.)", node->stats.count,
+			sprintf(col, "%ld/%c (%03.3f ms.)", node->stats.count,
 				node->stats.paralel?'P':'S',
 				ns2ms(node->stats.total)/node->stats.count);
 			printcol(std::string(col));
@@ -377,22 +1222,64 @@ private:
 				int(perc));
 
 			printcol(std::string(col));
+
+			double percentiles[] = {50.0, 99.0, 99.9};
+			for (double p : percentiles) {
+				sprintf(col, "%03.3f ms.", getPercentileInMilis(node->stats, p));
+				printcol(std::string(col));
+			}
+			sprintf(col, "%03.3f ms.", getMaxInMilis(node->stats));
+			printcol(std::string(col));
+
+			if (_counters) {
+				sprintf(col, "%.2f", node->stats.ipc());
+				printcol(std::string(col));
+				sprintf(col, "%.1f", node->stats.perCall(PerfCounters::LLC_MISSES));
+				printcol(std::string(col));
+				sprintf(col, "%.1f", node->stats.perCall(PerfCounters::BRANCH_MISSES));
+				printcol(std::string(col));
+			}
 			std::cout << std::endl;
 
 			for (auto child : node->children)
 				print(child, level+1, total_time);
 		}
 
+		void printCounters() {
+			char col[100];
+			for (auto & source : Profiler::getCounters()) {
+				_numCols = source.second.size() + 1;
+				printTitle(source.first);
+				for (auto & value : source.second) printTitle(value.first);
+				std::cout << std::endl;
+				printTopLine();
+				std::cout << std::endl;
+
+				printcol("");
+				for (auto & value : source.second) {
+					sprintf(col, "%.3f", value.second);
+					printcol(std::string(col));
+				}
+				std::cout << std::endl;
+				printBottomLine();
+				std::cout << std::endl;
+			}
+		}
+
 		void print() {
 			std::vector<Profiler::Stats> fstats = Profiler::getFusedStats();
 
-			if (fstats.size() == 0) return;
+			if (fstats.size() == 0) {
+				printCounters();
+				return;
+			}
 
 			int root_idx;
 			std::vector<Node> hierarchy;
 			for (int i = 0; i < fstats.size(); i++) {
 
 				if (fstats[i].key == "__root__") root_idx = i;
+				if (fstats[i].counted) _counters = true;
 
 				hierarchy.push_back(Node(fstats[i]));
 			}
@@ -410,6 +1297,16 @@ private:
 			printTitle("Num (Time)");
 			printTitle("Total Time");
 			printTitle("Total %");
+			printTitle("p50");
+			printTitle("p99");
+			printTitle("p99.9");
+			printTitle("Max");
+			if (_counters) {
+				_numCols += 3;
+				printTitle("IPC");
+				printTitle("LLC miss/call");
+				printTitle("Br miss/call");
+			}
 			std::cout << std::endl;
 			printTopLine();
 			std::cout << std::endl;
@@ -418,19 +1315,199 @@ private:
 
 			printBottomLine();
 			std::cout << std::endl;
+
+			printCounters();
 		}
 
 	private:
 
 		int _colWidth;
+		int _numCols;
+		bool _counters;
 
 	};
 
+	// Writes the scope tree in the folded-stack format read by flamegraph.pl
+	// and speedscope, one "__root__;P2;P3 <self-ns>" line per scope.
+	class FoldedStackPrinter {
+
+	public:
+		void print(std::ostream & os) {
+			std::vector<Profiler::Stats> fstats = Profiler::getFusedStats();
+
+			_children.assign(fstats.size(), std::vector<int>());
+			int root_idx = -1;
+			for (int i = 0; i < fstats.size(); i++) {
+				if (fstats[i].parent >= 0)
+					_children[fstats[i].parent].push_back(i);
+				else if (fstats[i].key == "__root__")
+					root_idx = i;
+			}
+
+			if (root_idx >= 0) print(os, fstats, root_idx, "");
+		}
+
+	private:
+		void print(std::ostream & os, const std::vector<Stats> & fstats,
+			   int node, const std::string & prefix) {
+
+			std::string path = prefix;
+			if (!path.empty()) path += ";";
+			for (char c : fstats[node].key)
+				path += (c == ';' || c == '\n') ? '_' : c;
+
+			// parallel children can add up to more than their parent
+			double self = fstats[node].total;
+			for (int child : _children[node])
+				self -= fstats[child].total;
+
+			if (self >= 1.0)
+				os << path << " " << std::uint64_t(self) << "\n";
+
+			for (int child : _children[node])
+				print(os, fstats, child, path);
+		}
+
+		std::vector<std::vector<int> > _children;
+	};
+
+	// Writes the recorded events in the Chrome trace-event JSON format,
+	// loadable in chrome://tracing and the Perfetto UI.
+	class ChromeTracePrinter {
+
+	public:
+		void print(std::ostream & os) {
+
+			flush();
+			std::unique_lock<std::mutex> lock(profile_mutex());
+
+			// copied so the threads can keep recording while printing
+			std::vector<std::vector<Event> > events(threads().size());
+			time_point_t origin = 0;
+			bool first = true;
+			for (int t = 0; t < threads().size(); t++) {
+				{
+					AccessGuard guard(*threads()[t]);
+					events[t] = threads()[t]->events;
+				}
+				for (auto & e : events[t]) {
+					if (first || e.time < origin) origin = e.time;
+					first = false;
+				}
+			}
+
+			os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+			first = true;
+			for (int t = 0; t < events.size(); t++) {
+				if (events[t].empty()) continue;
+
+				if (!first) os << ",";
+				os << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << t
+				   << ",\"args\":{\"name\":\"thread " << t << "\"}}";
+				first = false;
+
+				for (auto & e : events[t]) {
+					char ts[32];
+					sprintf(ts, "%.3f", ticks2ns(e.time - origin) / 1000.0);
+					os << ",{\"name\":";
+					printString(os, key_names()[e.key_id]);
+					os << ",\"ph\":\"" << e.phase << "\",\"ts\":" << ts
+					   << ",\"pid\":0,\"tid\":" << t << "}";
+				}
+			}
+			os << "]}" << std::endl;
+		}
+
+	private:
+		void printString(std::ostream & os, const std::string & str) {
+			os << "\"";
+			for (char c : str) {
+				if (c == '"' || c == '\\') os << '\\' << c;
+				else if (c >= 0 && c < 0x20) {
+					char esc[8];
+					sprintf(esc, "\\u%04x", c);
+					os << esc;
+				}
+				else os << c;
+			}
+			os << "\"";
+		}
+	};
+
 public:
 	static void print() {
 	 	ConsolePrinter printer;
 	 	printer.print();
 	}
+
+	// Begin/end events are recorded per thread while enabled, on top of
+	// the aggregated stats. Memory grows with the number of scopes run.
+	static void setEventRecording(bool enable) {
+		recording_events().store(enable);
+	}
+
+	static bool isRecordingEvents() {
+		return recording_events().load();
+	}
+
+	// Attributes cycles, instructions, LLC and branch misses to each scope.
+	// Each thread opens its counters on its first scope after enabling;
+	// threads that are refused access keep recording time only. Returns
+	// whether the calling thread got its counters.
+	static bool setHardwareCounters(bool enable) {
+		counting().store(enable);
+		return enable && thread_data().perf.open();
+	}
+
+	// Moves the stats bookkeeping off the instrumented threads: scopes only
+	// read the clock and push begin/end events to a per-thread ring, which
+	// a background thread drains into the records every period. Reports
+	// and clear() drain what is left first. Hardware counters are not
+	// collected while it runs. Start and stop it with no scope open.
+	static void startAggregator(std::chrono::microseconds period = std::chrono::milliseconds(1)) {
+		aggregator().start(period);
+	}
+
+	static void stopAggregator() {
+		aggregator().stop();
+	}
+
+	static bool isAggregating() {
+		return aggregating().load();
+	}
+
+	// Streams every scope begin/end to filename in the binary format of
+	// TraceFile.hpp, read back with TraceReader. Scopes only encode into a
+	// per-thread chunk; a writer thread writes full chunks, and scopes
+	// drop events rather than wait when all of their chunks are queued.
+	// Stop it with no scope open.
+	static bool startTrace(const std::string & filename) {
+		return trace_writer().start(filename);
+	}
+
+	static void stopTrace() {
+		trace_writer().stop();
+	}
+
+	static std::uint64_t getDroppedTraceEvents() {
+		std::unique_lock<std::mutex> lock(profile_mutex());
+		std::uint64_t dropped = 0;
+		for (auto & td : threads()) {
+			TraceBuffer * b = td->trace_buffer.load();
+			if (b) dropped += b->dropped.load();
+		}
+		return dropped;
+	}
+
+	static void printFoldedStacks(std::ostream & os) {
+		FoldedStackPrinter printer;
+		printer.print(os);
+	}
+
+	static void printChromeTrace(std::ostream & os) {
+		ChromeTracePrinter printer;
+		printer.print(os);
+	}
 };
 
 }
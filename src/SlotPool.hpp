@@ -0,0 +1,111 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <assert.h>
+
+namespace ByfronUtils {
+
+// Pool addressed by small handles instead of pointers. A handle packs a
+// slot index with the slot's generation, which is bumped on every release,
+// so get() turns a stale handle into nullptr instead of a dangling object.
+// Objects sit in one contiguous array. Not synchronized.
+//
+// With 32 bit ids, 20 bits index up to a million objects and 12 bits of
+// generation; 64 bit ids split 32/32.
+template <typename T, typename Id = std::uint32_t>
+class SlotPool {
+
+	static_assert(std::is_unsigned<Id>::value && (sizeof(Id) == 4 || sizeof(Id) == 8), "32 or 64 bit id");
+
+public:
+	static const int INDEX_BITS = sizeof(Id) == 4 ? 20 : 32;
+	static const Id INDEX_MASK = (Id(1) << INDEX_BITS) - 1;
+	static const Id MAX_GENERATION = Id(~Id(0)) >> INDEX_BITS;
+
+	// The default handle is never valid
+	struct Handle {
+		Handle() : id(0) {}
+		explicit Handle(Id i) : id(i) {}
+
+		std::size_t index() const { return id & INDEX_MASK; }
+		Id generation() const { return id >> INDEX_BITS; }
+		explicit operator bool() const { return id != 0; }
+		bool operator==(const Handle & other) const { return id == other.id; }
+		bool operator!=(const Handle & other) const { return id != other.id; }
+
+		Id id;
+	};
+
+	SlotPool() {}
+
+	// Adds a free object, moving the others if the array has to grow
+	template <typename... Args>
+	void emplace(Args &&... args) {
+		assert(_objects.size() < INDEX_MASK);
+		_objects.emplace_back(std::forward<Args>(args)...);
+		_generations.push_back(1);
+		_used.push_back(false);
+		_free.push_back(_objects.size() - 1);
+	}
+
+	// Invalid handle when no object is free
+	Handle acquire() {
+		if (_free.empty()) return Handle();
+		std::size_t index = _free.back();
+		_free.pop_back();
+		_used[index] = true;
+		return Handle((_generations[index] << INDEX_BITS) | Id(index));
+	}
+
+	// false for a stale or invalid handle
+	bool release(Handle h) {
+		if (!valid(h)) return false;
+		std::size_t index = h.index();
+		_used[index] = false;
+		_generations[index] = _generations[index] == MAX_GENERATION ? 1 : _generations[index] + 1;
+		_free.push_back(index);
+		return true;
+	}
+
+	bool valid(Handle h) const {
+		std::size_t index = h.index();
+		return index < _generations.size() && _used[index] && _generations[index] == h.generation();
+	}
+
+	// nullptr for a stale or invalid handle. Valid until the next emplace().
+	T * get(Handle h) {
+		return valid(h) ? &_objects[h.index()] : nullptr;
+	}
+
+	const T * get(Handle h) const {
+		return valid(h) ? &_objects[h.index()] : nullptr;
+	}
+
+	bool empty() const {
+		return _free.empty();
+	}
+
+	// Free objects
+	std::size_t size() const {
+		return _free.size();
+	}
+
+	std::size_t capacity() const {
+		return _objects.size();
+	}
+
+private:
+	std::vector<T> _objects;
+	std::vector<Id> _generations;
+	std::vector<bool> _used;
+	std::vector<std::size_t> _free;
+};
+
+template <typename T, typename Id> const int SlotPool<T, Id>::INDEX_BITS;
+template <typename T, typename Id> const Id SlotPool<T, Id>::INDEX_MASK;
+template <typename T, typename Id> const Id SlotPool<T, Id>::MAX_GENERATION;
+
+}
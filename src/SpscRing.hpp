@@ -0,0 +1,70 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace ByfronUtils {
+
+// Bounded single-producer single-consumer ring. push() and pop() never
+// block nor allocate. Each side caches the other side's index and only
+// reloads it when the ring looks full (or empty), so the two threads share
+// a cache line only when they actually meet.
+template <typename T>
+class SpscRing {
+
+public:
+	// capacity is rounded up to a power of two
+	explicit SpscRing(std::size_t capacity) : _head(0), _tail_cache(0),
+						  _tail(0), _head_cache(0) {
+		_size = 1;
+		while (_size < capacity) _size <<= 1;
+		_mask = _size - 1;
+		_buffer.reset(new T[_size]);
+	}
+
+	// producer side, false when full
+	bool push(const T & t) {
+		std::size_t tail = _tail.load(std::memory_order_relaxed);
+		if (tail - _head_cache == _size) {
+			_head_cache = _head.load(std::memory_order_acquire);
+			if (tail - _head_cache == _size) return false;
+		}
+		_buffer[tail & _mask] = t;
+		_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// consumer side, false when empty
+	bool pop(T & t) {
+		std::size_t head = _head.load(std::memory_order_relaxed);
+		if (head == _tail_cache) {
+			_tail_cache = _tail.load(std::memory_order_acquire);
+			if (head == _tail_cache) return false;
+		}
+		t = _buffer[head & _mask];
+		_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool empty() const {
+		return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+	}
+
+	std::size_t capacity() const {
+		return _size;
+	}
+
+private:
+	std::size_t _size, _mask;
+	std::unique_ptr<T[]> _buffer;
+
+	char _pad0[64];
+	std::atomic<std::size_t> _head;  // written by the consumer
+	std::size_t _tail_cache;
+	char _pad1[64];
+	std::atomic<std::size_t> _tail;  // written by the producer
+	std::size_t _head_cache;
+	char _pad2[64];
+};
+
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <assert.h>
+
+namespace ByfronUtils {
+
+// Pool of N objects stored inline, with no heap allocation at all. All
+// objects are built by the constructor and free slots form a stack of
+// indices, so acquire() and release are a couple of loads and stores.
+// Not synchronized; the pool must outlive the objects it hands out.
+template <typename T, std::size_t N>
+class StaticPool {
+
+private:
+	static_assert(N > 0 && N < 0xffffffff, "capacity");
+
+	// smallest index type that still leaves N free as the end marker
+	typedef typename std::conditional<(N < 0xff), std::uint8_t,
+		typename std::conditional<(N < 0xffff), std::uint16_t, std::uint32_t>::type>::type Index;
+
+	struct Releaser {
+		Releaser() : pool(nullptr) {}
+		explicit Releaser(StaticPool<T, N> * p) : pool(p) {}
+
+		void operator()(T * t) {
+			pool->release(t);
+		}
+
+		StaticPool<T, N> * pool;
+	};
+
+	T * object(std::size_t i) {
+		return reinterpret_cast<T *>(&_storage[i]);
+	}
+
+	void release(T * t) {
+		Index i = Index(t - object(0));
+		assert(i < N);
+		_next[i] = _head;
+		_head = i;
+		_size++;
+	}
+
+	std::array<typename std::aligned_storage<sizeof(T), alignof(T)>::type, N> _storage;
+	std::array<Index, N> _next;
+	Index _head;
+	std::size_t _size;
+
+public:
+
+	using PtrType = std::unique_ptr<T, Releaser>;
+
+	// Every object is constructed from args
+	template <typename... Args>
+	explicit StaticPool(const Args &... args) : _head(0), _size(N) {
+		for (std::size_t i = 0; i < N; i++) {
+			new (&_storage[i]) T(args...);
+			_next[i] = Index(i + 1);
+		}
+	}
+
+	~StaticPool() {
+		for (std::size_t i = 0; i < N; i++) object(i)->~T();
+	}
+
+	// Empty pointer when all objects are out
+	PtrType acquire() {
+		if (_head == N) return PtrType(nullptr, Releaser(this));
+		Index i = _head;
+		_head = _next[i];
+		_size--;
+		return PtrType(object(i), Releaser(this));
+	}
+
+	bool empty() const {
+		return _head == N;
+	}
+
+	std::size_t size() const {
+		return _size;
+	}
+
+	static constexpr std::size_t capacity() {
+		return N;
+	}
+
+private:
+	StaticPool(const StaticPool &);
+	StaticPool & operator=(const StaticPool &);
+};
+
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <mutex>
+#include <vector>
+
+namespace ByfronUtils {
+
+// Small integer naming the calling thread, handed to the next thread once
+// this one exits. -1 when MAX threads already hold one.
+class ThreadSlot {
+
+public:
+	static const int MAX = 256;
+
+	static int get() {
+		static thread_local Holder holder;
+		return holder.slot;
+	}
+
+private:
+	struct Holder {
+		Holder() {
+			std::unique_lock<std::mutex> lock(mutex());
+			if (!free_slots().empty()) {
+				slot = free_slots().back();
+				free_slots().pop_back();
+			}
+			else slot = next() < MAX ? next()++ : -1;
+		}
+
+		~Holder() {
+			if (slot < 0) return;
+			std::unique_lock<std::mutex> lock(mutex());
+			free_slots().push_back(slot);
+		}
+
+		int slot;
+	};
+
+	static std::mutex & mutex() { static std::mutex m; return m; }
+	static std::vector<int> & free_slots() { static std::vector<int> f; return f; }
+	static int & next() { static int n = 0; return n; }
+};
+
+}
@@ -0,0 +1,277 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ByfronUtils {
+
+// Binary Profiler trace, in native byte order:
+//
+//   header   "BYFTRACE", u32 version, u32 reserved, f64 ns per tick
+//   records  u8 type, then
+//     'S'    u32 key id, u32 length, name bytes
+//     'C'    u32 thread, u64 first tick, u32 events, u32 bytes, events
+//
+// An event is varint(key_id << 1 | is_end) followed by varint(ticks since
+// the previous event of its chunk, or since the chunk's first tick). A
+// key's 'S' record always precedes the first chunk that uses it.
+class TraceFormat {
+
+public:
+	static const std::uint32_t VERSION = 1;
+	static const std::size_t HEADER_SIZE = 24;
+	static const std::size_t CHUNK_HEADER_SIZE = 21;
+
+	static const char * magic() {
+		return "BYFTRACE";
+	}
+
+	static std::size_t putVarint(std::uint8_t * p, std::uint64_t v) {
+		std::size_t n = 0;
+		while (v >= 0x80) {
+			p[n++] = std::uint8_t(v) | 0x80;
+			v >>= 7;
+		}
+		p[n++] = std::uint8_t(v);
+		return n;
+	}
+
+	// nullptr on a truncated value
+	static const std::uint8_t * getVarint(const std::uint8_t * p, const std::uint8_t * end,
+					      std::uint64_t & v) {
+		v = 0;
+		for (int shift = 0; p < end && shift < 64; shift += 7) {
+			std::uint8_t b = *p++;
+			v |= std::uint64_t(b & 0x7f) << shift;
+			if (!(b & 0x80)) return p;
+		}
+		return nullptr;
+	}
+
+	static void writeHeader(FILE * f, double ns_per_tick) {
+		std::uint32_t version = VERSION, reserved = 0;
+		fwrite(magic(), 1, 8, f);
+		fwrite(&version, sizeof(version), 1, f);
+		fwrite(&reserved, sizeof(reserved), 1, f);
+		fwrite(&ns_per_tick, sizeof(ns_per_tick), 1, f);
+	}
+
+	static void writeName(FILE * f, std::uint32_t key_id, const std::string & name) {
+		std::uint32_t length = name.size();
+		fputc('S', f);
+		fwrite(&key_id, sizeof(key_id), 1, f);
+		fwrite(&length, sizeof(length), 1, f);
+		fwrite(name.data(), 1, length, f);
+	}
+};
+
+// Fixed-size block of encoded events from one thread
+class TraceChunk {
+
+public:
+	static const std::size_t CAPACITY = 1 << 16;
+	static const std::size_t MAX_EVENT = 20;
+
+	explicit TraceChunk(std::uint32_t thread) : _thread(thread), _first(0), _last(0),
+						    _count(0), _size(0) {}
+
+	bool full() const {
+		return _size + MAX_EVENT > CAPACITY;
+	}
+
+	bool empty() const {
+		return _count == 0;
+	}
+
+	std::uint32_t thread() const {
+		return _thread;
+	}
+
+	std::uint32_t count() const {
+		return _count;
+	}
+
+	void append(std::uint64_t time, int key_id, bool end) {
+		if (!_count) _first = _last = time;
+		_size += TraceFormat::putVarint(_data + _size, (std::uint64_t(key_id) << 1) | end);
+		_size += TraceFormat::putVarint(_data + _size, time - _last);
+		_last = time;
+		_count++;
+	}
+
+	void write(FILE * f) const {
+		fputc('C', f);
+		fwrite(&_thread, sizeof(_thread), 1, f);
+		fwrite(&_first, sizeof(_first), 1, f);
+		fwrite(&_count, sizeof(_count), 1, f);
+		fwrite(&_size, sizeof(_size), 1, f);
+		fwrite(_data, 1, _size, f);
+	}
+
+	void reset() {
+		_count = _size = 0;
+	}
+
+private:
+	std::uint32_t _thread;
+	std::uint64_t _first, _last;
+	std::uint32_t _count, _size;
+	std::uint8_t _data[CAPACITY];
+};
+
+// Iterates the events of a trace file through a read-only mapping,
+// decoding them in place.
+class TraceReader {
+
+public:
+	struct Event {
+		std::uint32_t thread;
+		int key_id;
+		char phase;
+		std::uint64_t time;
+	};
+
+	explicit TraceReader(const std::string & filename) : _begin(nullptr), _size(0),
+							     _ns_per_tick(1.0), _pos(nullptr),
+							     _chunk_end(nullptr), _left(0),
+							     _thread(0), _time(0) {
+		int fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd < 0) return;
+
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size >= TraceFormat::HEADER_SIZE) {
+			void * map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (map != MAP_FAILED) {
+				_begin = static_cast<const std::uint8_t *>(map);
+				_size = st.st_size;
+			}
+		}
+		::close(fd);
+
+		if (_begin && (memcmp(_begin, TraceFormat::magic(), 8) ||
+			       read<std::uint32_t>(_begin + 8) != TraceFormat::VERSION)) {
+			unmap();
+			return;
+		}
+		if (_begin) {
+			_ns_per_tick = read<double>(_begin + 16);
+			rewind();
+		}
+	}
+
+	~TraceReader() {
+		unmap();
+	}
+
+	bool valid() const {
+		return _begin != nullptr;
+	}
+
+	std::size_t size() const {
+		return _size;
+	}
+
+	double nsPerTick() const {
+		return _ns_per_tick;
+	}
+
+	void rewind() {
+		_pos = _begin + TraceFormat::HEADER_SIZE;
+		_chunk_end = _pos;
+		_left = 0;
+	}
+
+	// Next event in file order (per thread in time order), false at the
+	// end of the trace or on a truncated record
+	bool next(Event & e) {
+
+		const std::uint8_t * end = _begin + _size;
+
+		while (!_left) {
+			if (!_begin || _chunk_end >= end) return false;
+			_pos = _chunk_end;
+
+			char type = *_pos++;
+			if (type == 'S') {
+				if (_pos + 8 > end) return false;
+				std::uint32_t id = read<std::uint32_t>(_pos);
+				std::uint32_t length = read<std::uint32_t>(_pos + 4);
+				if (_pos + 8 + length > end) return false;
+				if (id >= _names.size()) _names.resize(id + 1, Name(nullptr, 0));
+				_names[id] = Name(reinterpret_cast<const char *>(_pos + 8), length);
+				_chunk_end = _pos + 8 + length;
+			}
+			else if (type == 'C') {
+				if (_pos + TraceFormat::CHUNK_HEADER_SIZE - 1 > end) return false;
+				_thread = read<std::uint32_t>(_pos);
+				_time = read<std::uint64_t>(_pos + 4);
+				_left = read<std::uint32_t>(_pos + 12);
+				std::uint32_t bytes = read<std::uint32_t>(_pos + 16);
+				_pos += TraceFormat::CHUNK_HEADER_SIZE - 1;
+				if (_pos + bytes > end) return false;
+				_chunk_end = _pos + bytes;
+			}
+			else return false;
+		}
+
+		std::uint64_t key, delta;
+		_pos = TraceFormat::getVarint(_pos, _chunk_end, key);
+		if (_pos) _pos = TraceFormat::getVarint(_pos, _chunk_end, delta);
+		if (!_pos) {
+			_left = 0;
+			_chunk_end = end;
+			return false;
+		}
+
+		_time += delta;
+		_left--;
+		e.thread = _thread;
+		e.key_id = key >> 1;
+		e.phase = key & 1 ? 'E' : 'B';
+		e.time = _time;
+		return true;
+	}
+
+	// Name of a key whose 'S' record has been read by next()
+	std::string name(int key_id) const {
+		if (key_id < 0 || key_id >= _names.size() || !_names[key_id].first) return "";
+		return std::string(_names[key_id].first, _names[key_id].second);
+	}
+
+private:
+	TraceReader(const TraceReader &);
+	TraceReader & operator=(const TraceReader &);
+
+	typedef std::pair<const char *, std::size_t> Name;
+
+	template <typename T>
+	static T read(const std::uint8_t * p) {
+		T v;
+		memcpy(&v, p, sizeof(T));
+		return v;
+	}
+
+	void unmap() {
+		if (_begin) munmap(const_cast<std::uint8_t *>(_begin), _size);
+		_begin = nullptr;
+		_size = 0;
+	}
+
+	const std::uint8_t * _begin;
+	std::size_t _size;
+	double _ns_per_tick;
+
+	const std::uint8_t * _pos;
+	const std::uint8_t * _chunk_end;
+	std::uint32_t _left, _thread;
+	std::uint64_t _time;
+	std::vector<Name> _names;
+};
+
+}
@@ -0,0 +1,105 @@
+#include "gtest.h"
+#include "ConcurrentPool.hpp"
+#include "Pool.hpp"
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+using namespace ByfronUtils;
+
+// Timings only, run with the bench target
+
+namespace {
+
+const int NUM_THREADS = 8;
+
+}
+
+TEST(BenchConcurrentPool, Throughput) {
+
+	const int iterations = 100000;
+
+	ConcurrentPool<int> lock_free;
+	ConcurrentPool<int> magazines(32);
+	std::shared_ptr<Pool<int> > locked = std::make_shared<Pool<int> >();
+	for (int i = 0; i < 2 * NUM_THREADS; i++) {
+		lock_free.add(std::unique_ptr<int>(new int(i)));
+		magazines.add(std::unique_ptr<int>(new int(i)));
+		locked->add(std::unique_ptr<int>(new int(i)));
+	}
+
+	auto run = [](std::function<void()> op) {
+		auto start = std::chrono::steady_clock::now();
+		std::vector<std::thread> workers;
+		for (int t = 0; t < NUM_THREADS; t++) {
+			workers.push_back(std::thread([&op]() {
+				for (int i = 0; i < iterations; i++) op();
+			}));
+		}
+		for (auto & w : workers) w.join();
+		double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		return NUM_THREADS * iterations / s / 1e6;
+	};
+
+	double lock_free_mops = run([&lock_free]() {
+		auto v = lock_free.acquire();
+		EXPECT_TRUE(bool(v));
+	});
+
+	double magazine_mops = run([&magazines]() {
+		auto v = magazines.acquire();
+		EXPECT_TRUE(bool(v));
+	});
+
+	double locked_mops = run([&locked]() {
+		auto v = locked->acquire();
+		EXPECT_TRUE(bool(v));
+	});
+
+	std::cout << "acquire/release with " << NUM_THREADS << " threads: "
+		  << lock_free_mops << " Mops/s lock-free, "
+		  << magazine_mops << " Mops/s with magazines, "
+		  << locked_mops << " Mops/s Pool" << std::endl;
+}
+
+TEST(BenchConcurrentPool, BatchThroughput) {
+
+	const int batch = 256;
+	const int rounds = 500;
+
+	ConcurrentPool<int> pool;
+	for (int i = 0; i < NUM_THREADS * batch; i++)
+		pool.add(std::unique_ptr<int>(new int(i)));
+
+	auto run = [&pool](bool batched) {
+		auto start = std::chrono::steady_clock::now();
+		std::vector<std::thread> workers;
+		for (int t = 0; t < NUM_THREADS; t++) {
+			workers.push_back(std::thread([&pool, batched]() {
+				std::vector<ConcurrentPool<int>::PtrType> held;
+				held.reserve(batch);
+				for (int r = 0; r < rounds; r++) {
+					if (batched) {
+						pool.acquireN(std::back_inserter(held), batch);
+						pool.releaseN(held.begin(), held.end());
+					}
+					else {
+						for (int i = 0; i < batch; i++) held.push_back(pool.acquire());
+					}
+					held.clear();
+				}
+			}));
+		}
+		for (auto & w : workers) w.join();
+		double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		return ns / (NUM_THREADS * rounds * batch);
+	};
+
+	double single = run(false);
+	double batched = run(true);
+	std::cout << "ConcurrentPool per object with " << NUM_THREADS << " threads: " << single
+		  << " ns single, " << batched << " ns in batches of " << batch << std::endl;
+}
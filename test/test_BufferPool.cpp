@@ -0,0 +1,106 @@
+#include "gtest.h"
+#include "BufferPool.hpp"
+#include <vector>
+
+using namespace ByfronUtils;
+
+TEST(TestBufferPool, Classes) {
+
+	BufferPool pool(1 << 16);
+	EXPECT_EQ(pool.capacityFor(0), 64);
+	EXPECT_EQ(pool.capacityFor(64), 64);
+	EXPECT_EQ(pool.capacityFor(65), 80);
+	EXPECT_EQ(pool.capacityFor(100), 112);
+	EXPECT_EQ(pool.capacityFor(113), 128);
+	EXPECT_EQ(pool.capacityFor(129), 160);
+	EXPECT_EQ(pool.capacityFor(1000), 1024);
+	EXPECT_EQ(pool.capacityFor(1025), 1280);
+	EXPECT_EQ(pool.maxCapacity(), 1 << 16);
+
+	// never wastes a quarter or more
+	for (std::size_t bytes = 65; bytes <= pool.maxCapacity(); bytes += 37) {
+		std::size_t capacity = pool.capacityFor(bytes);
+		EXPECT_GE(capacity, bytes);
+		EXPECT_LT(capacity - bytes, capacity / 4);
+	}
+}
+
+TEST(TestBufferPool, Reuse) {
+
+	BufferPool pool;
+	const char * data;
+	{
+		BufferPool::Handle buffer = pool.acquire(100);
+		EXPECT_TRUE(buffer->empty());
+		EXPECT_EQ(buffer->capacity(), 112);
+		buffer->resize(100, 'x');
+		data = buffer->data();
+	}
+	EXPECT_EQ(pool.retained(), 112);
+
+	// same class, same buffer, emptied with its capacity
+	BufferPool::Handle buffer = pool.acquire(110);
+	EXPECT_EQ(buffer->data(), data);
+	EXPECT_TRUE(buffer->empty());
+	EXPECT_EQ(buffer->capacity(), 112);
+	EXPECT_EQ(pool.retained(), 0);
+
+	BufferPool::Handle other = pool.acquire(90);
+	EXPECT_NE(other->data(), data);
+}
+
+TEST(TestBufferPool, Cap) {
+
+	BufferPool pool(1 << 12, 256);
+	{
+		std::vector<BufferPool::Handle> buffers;
+		for (int i = 0; i < 3; i++) buffers.push_back(pool.acquire(128));
+		for (int i = 0; i < 3; i++) buffers.push_back(pool.acquire(1024));
+		for (BufferPool::Handle & buffer : buffers) EXPECT_TRUE(bool(buffer));
+	}
+
+	// two buffers of 128 fit the cap, none of 1024
+	EXPECT_EQ(pool.retained(), 256);
+}
+
+TEST(TestBufferPool, Grown) {
+
+	BufferPool pool(1 << 12, 4096);
+	{
+		std::vector<BufferPool::Handle> buffers;
+		for (int i = 0; i < 4; i++) {
+			buffers.push_back(pool.acquire(64));
+			buffers.back()->resize(1 << 20);
+		}
+	}
+
+	// grown buffers go back at their class capacity
+	EXPECT_EQ(pool.retained(), 4 * 64);
+	for (int i = 0; i < 4; i++) EXPECT_EQ(pool.acquire(64)->capacity(), 64);
+}
+
+TEST(TestBufferPool, Oversize) {
+
+	BufferPool pool(1 << 12);
+	EXPECT_EQ(pool.capacityFor(1 << 13), 1 << 13);
+
+	// unpooled, of exactly the size asked
+	BufferPool::Handle buffer = pool.acquire(1 << 13);
+	ASSERT_TRUE(bool(buffer));
+	EXPECT_TRUE(buffer->empty());
+	EXPECT_EQ(buffer->capacity(), 1 << 13);
+	buffer.reset();
+	EXPECT_FALSE(buffer);
+	EXPECT_EQ(pool.retained(), 0);
+}
+
+TEST(TestBufferPool, OutlivesPool) {
+
+	BufferPool::Handle buffer;
+	{
+		BufferPool pool;
+		buffer = pool.acquire(10);
+	}
+	buffer->push_back('x');
+	buffer.reset();
+}
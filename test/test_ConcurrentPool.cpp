@@ -0,0 +1,191 @@
+#include "gtest.h"
+#include "ConcurrentPool.hpp"
+#include "Pool.hpp"
+#include <algorithm>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+using namespace ByfronUtils;
+
+namespace {
+
+struct Item {
+	Item() : owner(0), uses(0) {}
+	std::atomic<int> owner;
+	long uses;
+};
+
+const int NUM_THREADS = 8;
+
+TEST(TestConcurrentPool, ConcurrentPool) {
+
+	ConcurrentPool<int> pool;
+	EXPECT_TRUE(pool.empty());
+	EXPECT_FALSE(pool.acquire());
+
+	pool.add(std::unique_ptr<int>(new int(45)));
+	EXPECT_FALSE(pool.empty());
+
+	{
+		auto v = pool.acquire();
+		ASSERT_TRUE(bool(v));
+		EXPECT_EQ(*v, 45);
+		EXPECT_TRUE(pool.empty());
+		EXPECT_FALSE(pool.acquire());
+	}
+	EXPECT_EQ(pool.size(), 1);
+
+	for (int i = 0; i < 1000; i++)
+		pool.add(std::unique_ptr<int>(new int(i)));
+	EXPECT_EQ(pool.size(), 1001);
+}
+
+// Every thread takes two items at a time and checks nobody else holds them
+void stress(ConcurrentPool<Item> & pool) {
+
+	const int num_items = 16;
+	for (int i = 0; i < num_items; i++)
+		pool.add(std::unique_ptr<Item>(new Item()));
+
+	std::atomic<long> misses(0);
+	std::vector<std::thread> workers;
+	for (int t = 0; t < NUM_THREADS; t++) {
+		workers.push_back(std::thread([&pool, &misses, t]() {
+			for (int i = 0; i < 20000; i++) {
+				auto a = pool.acquire();
+				auto b = pool.acquire();
+				if (!a || !b) {
+					misses++;
+					continue;
+				}
+				int expected = 0;
+				ASSERT_TRUE(a->owner.compare_exchange_strong(expected, t + 1));
+				expected = 0;
+				ASSERT_TRUE(b->owner.compare_exchange_strong(expected, t + 1));
+				a->uses++;
+				b->uses++;
+				a->owner = 0;
+				b->owner = 0;
+			}
+			pool.flush();
+		}));
+	}
+	for (auto & w : workers) w.join();
+
+	EXPECT_EQ(pool.size(), num_items);
+
+	long uses = 0;
+	std::vector<ConcurrentPool<Item>::PtrType> items;
+	while (auto item = pool.acquire()) {
+		uses += item->uses;
+		items.push_back(std::move(item));
+	}
+	EXPECT_EQ(items.size(), num_items);
+	EXPECT_EQ(uses, 2 * (NUM_THREADS * 20000 - misses));
+}
+
+}
+
+TEST(TestConcurrentPool, Stress) {
+	ConcurrentPool<Item> pool;
+	stress(pool);
+}
+
+TEST(TestConcurrentPool, Magazines) {
+
+	ConcurrentPool<int> pool(4);
+	for (int i = 0; i < 8; i++)
+		pool.add(std::unique_ptr<int>(new int(i)));
+
+	// the first acquire takes single objects, releases fill both magazines
+	{
+		std::vector<ConcurrentPool<int>::PtrType> held;
+		for (int i = 0; i < 8; i++) held.push_back(pool.acquire());
+		EXPECT_TRUE(pool.empty());
+		EXPECT_FALSE(pool.acquire());
+	}
+	EXPECT_EQ(pool.size(), 0);
+	EXPECT_TRUE(bool(pool.acquire()));
+
+	// a third magazine's worth sends a full one to the depot
+	for (int i = 0; i < 4; i++)
+		pool.add(std::unique_ptr<int>(new int(8 + i)));
+	{
+		std::vector<ConcurrentPool<int>::PtrType> held;
+		while (auto v = pool.acquire()) held.push_back(std::move(v));
+		EXPECT_EQ(held.size(), 12);
+	}
+	EXPECT_EQ(pool.size(), 4);
+
+	// another thread takes the full magazine as a whole
+	std::thread other([&pool]() {
+		EXPECT_TRUE(bool(pool.acquire()));
+		EXPECT_EQ(pool.size(), 0);
+		pool.flush();
+	});
+	other.join();
+
+	pool.flush();
+	EXPECT_EQ(pool.size(), 12);
+}
+
+TEST(TestConcurrentPool, MagazineStress) {
+	ConcurrentPool<Item> pool(2);
+	stress(pool);
+}
+
+TEST(TestConcurrentPool, Batch) {
+
+	ConcurrentPool<int> pool;
+	for (int i = 0; i < 10; i++)
+		pool.add(std::unique_ptr<int>(new int(i)));
+
+	std::vector<ConcurrentPool<int>::PtrType> held;
+	EXPECT_EQ(pool.acquireN(std::back_inserter(held), 4), 4);
+	EXPECT_EQ(pool.size(), 6);
+	EXPECT_EQ(pool.acquireN(std::back_inserter(held), 100), 6);
+	EXPECT_TRUE(pool.empty());
+
+	std::vector<int> seen;
+	for (auto & h : held) seen.push_back(*h);
+	std::sort(seen.begin(), seen.end());
+	for (int i = 0; i < 10; i++) EXPECT_EQ(seen[i], i);
+
+	pool.releaseN(held.begin(), held.end());
+	for (auto & h : held) EXPECT_FALSE(h);
+	EXPECT_EQ(pool.size(), 10);
+	held.clear();
+	EXPECT_EQ(pool.acquireN(std::back_inserter(held), 100), 10);
+}
+
+TEST(TestConcurrentPool, BatchStress) {
+
+	ConcurrentPool<Item> pool;
+	const int num_items = 256;
+	for (int i = 0; i < num_items; i++)
+		pool.add(std::unique_ptr<Item>(new Item()));
+
+	std::vector<std::thread> workers;
+	for (int t = 0; t < NUM_THREADS; t++) {
+		workers.push_back(std::thread([&pool, t]() {
+			std::vector<ConcurrentPool<Item>::PtrType> held;
+			for (int i = 0; i < 5000; i++) {
+				pool.acquireN(std::back_inserter(held), 1 + (i + t) % 48);
+				for (auto & item : held) {
+					int expected = 0;
+					ASSERT_TRUE(item->owner.compare_exchange_strong(expected, t + 1));
+					item->uses++;
+					item->owner = 0;
+				}
+				pool.releaseN(held.begin(), held.end());
+				held.clear();
+			}
+		}));
+	}
+	for (auto & w : workers) w.join();
+	EXPECT_EQ(pool.size(), num_items);
+
+	std::vector<ConcurrentPool<Item>::PtrType> all;
+	EXPECT_EQ(pool.acquireN(std::back_inserter(all), num_items + 1), num_items);
+}
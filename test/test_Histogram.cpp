@@ -0,0 +1,42 @@
+#include "gtest.h"
+#include "Histogram.hpp"
+
+using namespace ByfronUtils;
+
+TEST(TestHistogram, Buckets) {
+
+	for (std::uint64_t v = 0; v < 100000; v += 7) {
+		int b = Histogram::bucket(v);
+		EXPECT_GE(Histogram::upper(b), v);
+		EXPECT_LE(Histogram::upper(b) - v, v / Histogram::SUB_COUNT);
+		if (b > 0) EXPECT_LT(Histogram::upper(b - 1), v);
+	}
+	EXPECT_EQ(Histogram::upper(Histogram::bucket(~0ULL)), ~0ULL);
+}
+
+TEST(TestHistogram, Percentiles) {
+
+	Histogram h;
+	EXPECT_EQ(h.percentile(50), 0);
+
+	for (std::uint64_t v = 1; v <= 1000; v++)
+		h.record(v * 1000);
+
+	EXPECT_EQ(h.count(), 1000);
+	EXPECT_EQ(h.min(), 1000);
+	EXPECT_EQ(h.max(), 1000000);
+	EXPECT_NEAR(h.percentile(50), 500000, 500000 / Histogram::SUB_COUNT);
+	EXPECT_NEAR(h.percentile(99), 990000, 990000 / Histogram::SUB_COUNT);
+	EXPECT_EQ(h.percentile(100), 1000000);
+
+	Histogram tail;
+	tail.record(5000000);
+	h.merge(tail);
+	EXPECT_EQ(h.count(), 1001);
+	EXPECT_EQ(h.max(), 5000000);
+	EXPECT_EQ(h.percentile(100), 5000000);
+	EXPECT_NEAR(h.percentile(50), 500000, 500000 / Histogram::SUB_COUNT);
+
+	h.clear();
+	EXPECT_EQ(h.count(), 0);
+}
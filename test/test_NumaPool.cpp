@@ -0,0 +1,51 @@
+#include "gtest.h"
+#include "NumaPool.hpp"
+#include <thread>
+#include <vector>
+
+using namespace ByfronUtils;
+
+TEST(TestNumaPool, NumaPool) {
+
+	ASSERT_GE(NumaTopology::numNodes(), 1);
+	int local = NumaTopology::currentNode();
+	EXPECT_GE(local, 0);
+	EXPECT_LT(local, NumaTopology::numNodes());
+
+	NumaPool<std::vector<int> > pool;
+	EXPECT_FALSE(pool.acquire());
+
+	// more than a chunk's worth
+	const int num_objects = 2 * NumaPool<std::vector<int> >::CHUNK_BYTES / sizeof(std::vector<int>);
+	for (int i = 0; i < num_objects; i++) pool.emplace(3, i);
+	EXPECT_EQ(pool.size(), num_objects);
+
+	std::vector<NumaPool<std::vector<int> >::Handle> held;
+	while (auto v = pool.acquire()) {
+		EXPECT_EQ(v->size(), 3);
+		held.push_back(std::move(v));
+	}
+	EXPECT_EQ(held.size(), num_objects);
+	EXPECT_TRUE(pool.empty());
+
+	// released from another thread, back to the object's own node
+	int node = held[0].node();
+	std::thread other([&held]() { held.clear(); });
+	other.join();
+	EXPECT_EQ(pool.size(node), pool.size());
+	EXPECT_EQ(pool.size(), num_objects);
+}
+
+TEST(TestNumaPool, Steal) {
+
+	NumaPool<int> pool;
+	int last = pool.numNodes() - 1;
+	int local = NumaTopology::currentNode();
+	pool.emplaceOn(last, 42);
+
+	auto v = pool.acquire();
+	ASSERT_TRUE(bool(v));
+	EXPECT_EQ(*v, 42);
+	EXPECT_EQ(v.node(), last);
+	EXPECT_EQ(pool.steals(), local == last ? 0 : 1);
+}
@@ -0,0 +1,112 @@
+#include "gtest.h"
+#include "OwnerPool.hpp"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace ByfronUtils;
+
+TEST(TestOwnerPool, OwnerPool) {
+
+	OwnerPool<int> pool;
+	EXPECT_FALSE(pool.acquire());
+	for (int i = 0; i < 100; i++) pool.emplace(i);
+
+	std::vector<OwnerPool<int>::Handle> held;
+	while (auto v = pool.acquire()) held.push_back(std::move(v));
+	EXPECT_EQ(held.size(), 100);
+
+	// objects are the owner's only
+	std::thread other([&pool]() {
+		EXPECT_FALSE(pool.acquire());
+	});
+	other.join();
+
+	// released elsewhere, they wait on the remote list until the owner misses
+	std::thread releaser([&held]() {
+		held.resize(50);
+	});
+	releaser.join();
+	EXPECT_FALSE(pool.hasLocal());
+
+	held.resize(40);
+	EXPECT_TRUE(pool.hasLocal());
+
+	int count = 0;
+	while (auto v = pool.acquire()) {
+		held.push_back(std::move(v));
+		count++;
+	}
+	EXPECT_EQ(count, 60);
+}
+
+TEST(TestOwnerPool, Pipeline) {
+
+	const int num_items = 64;
+	const int iterations = 100000;
+
+	OwnerPool<long> pool;
+	for (int i = 0; i < num_items; i++) pool.emplace(0);
+
+	// acquired on this thread, released on the consumer
+	std::vector<OwnerPool<long>::Handle> queue(iterations);
+	std::atomic<int> produced(0);
+	std::thread consumer([&]() {
+		for (int i = 0; i < iterations; i++) {
+			while (produced.load(std::memory_order_acquire) <= i) std::this_thread::yield();
+			(*queue[i])++;
+			queue[i].reset();
+		}
+	});
+
+	long misses = 0;
+	for (int i = 0; i < iterations; i++) {
+		OwnerPool<long>::Handle v;
+		while (!(v = pool.acquire())) {
+			misses++;
+			std::this_thread::yield();
+		}
+		queue[i] = std::move(v);
+		produced.store(i + 1, std::memory_order_release);
+	}
+	consumer.join();
+
+	long uses = 0, count = 0;
+	std::vector<OwnerPool<long>::Handle> all;
+	while (auto v = pool.acquire()) {
+		uses += *v;
+		count++;
+		all.push_back(std::move(v));
+	}
+	EXPECT_EQ(count, num_items);
+	EXPECT_EQ(uses, iterations);
+}
+
+TEST(TestOwnerPool, Overflow) {
+
+	// more live threads than ThreadSlot has slots
+	const int num_threads = ThreadSlot::MAX + 8;
+	OwnerPool<int> pool;
+	std::atomic<int> started(0), unslotted(0), failed(0);
+	std::atomic<bool> go(false);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < num_threads; t++) {
+		threads.push_back(std::thread([&]() {
+			if (ThreadSlot::get() < 0) unslotted++;
+			started++;
+			while (!go.load()) std::this_thread::yield();
+
+			for (int i = 0; i < 100; i++) {
+				pool.emplace(i);
+				OwnerPool<int>::Handle v = pool.acquire();
+				if (!v) failed++;
+			}
+		}));
+	}
+	while (started.load() < num_threads) std::this_thread::yield();
+	go.store(true);
+	for (auto & t : threads) t.join();
+
+	EXPECT_GE(unslotted.load(), 8);
+	EXPECT_EQ(failed.load(), 0);
+}
@@ -1,6 +1,15 @@
 #include "gtest.h"
 #include "Pool.hpp"
+#include "Profiler.hpp"
+#include <atomic>
+#include <chrono>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <unistd.h>
+#include <vector>
 
 using namespace ByfronUtils;
 
@@ -21,10 +30,11 @@ TEST(TestPool, Pool) {
 
 	EXPECT_TRUE(not pool->empty());
 	{
-		std::shared_ptr<int> second_v;
+		Pool<int>::SharedHandle second_v;
 		{
-			auto v = pool->acquire();
+			Pool<int>::SharedHandle v(pool->acquire());
 			second_v = v;
+			EXPECT_EQ(v.useCount(), 2);
 			EXPECT_TRUE(pool->empty());
 			EXPECT_TRUE(*v == 45);
 		}
@@ -33,3 +43,492 @@ TEST(TestPool, Pool) {
 	}
 	EXPECT_TRUE(not pool->empty());	
 }
+
+TEST(TestPool, Handle) {
+
+	static_assert(sizeof(Pool<int>::Handle) == sizeof(void *), "handle is a single pointer");
+
+	Pool<int> pool;
+	pool.add(std::unique_ptr<int>(new int(1)));
+	pool.add(std::unique_ptr<int>(new int(2)));
+
+	Pool<int>::Handle a = pool.acquire();
+	Pool<int>::Handle b = std::move(a);
+	EXPECT_FALSE(a);
+	EXPECT_EQ(*b, 1);
+	EXPECT_EQ(pool.size(), 1);
+
+	a = pool.acquire();
+	a = std::move(b);
+	EXPECT_EQ(*a, 1);
+	EXPECT_EQ(pool.size(), 1);
+
+	a.reset();
+	EXPECT_EQ(pool.size(), 2);
+}
+
+TEST(TestPool, OutlivesPool) {
+
+	Pool<int>::Handle handle;
+	Pool<int>::SharedHandle shared;
+	{
+		Pool<int> pool;
+		pool.add(std::unique_ptr<int>(new int(7)));
+		pool.add(std::unique_ptr<int>(new int(8)));
+		pool.add(std::unique_ptr<int>(new int(9)));
+		handle = pool.acquire();
+		shared = Pool<int>::SharedHandle(pool.acquire());
+	}
+	// the objects are deleted with the handles instead
+	EXPECT_EQ(*handle, 7);
+	EXPECT_EQ(*shared, 8);
+}
+
+TEST(TestPool, ReleaseWhileDestroyed) {
+
+	for (int round = 0; round < 200; round++) {
+		std::unique_ptr<Pool<int> > pool(new Pool<int>());
+		for (int i = 0; i < 4; i++) {
+			pool->add(std::unique_ptr<int>(new int(i)));
+			pool->emplace(i);
+		}
+		std::vector<Pool<int>::Handle> handles;
+		for (int i = 0; i < 6; i++) handles.push_back(pool->acquire());
+
+		// handles go back while the pool goes away
+		std::atomic<bool> go(false);
+		std::thread releaser([&handles, &go]() {
+			while (!go.load()) {}
+			for (auto & handle : handles) handle.reset();
+		});
+		go.store(true);
+		pool.reset();
+		releaser.join();
+	}
+}
+
+namespace {
+
+struct alignas(64) Aligned {
+	Aligned(int v, const char * t) : value(v), tag(t) { constructed++; }
+	~Aligned() { destructed++; }
+	int value;
+	std::string tag;
+	static int constructed, destructed;
+};
+
+int Aligned::constructed = 0;
+int Aligned::destructed = 0;
+
+}
+
+TEST(TestPool, Slab) {
+
+	Aligned::constructed = Aligned::destructed = 0;
+	Pool<Aligned>::Handle survivor;
+	{
+		Pool<Aligned> pool(4);
+		for (int i = 0; i < 10; i++) pool.emplace(i, "slab");
+		EXPECT_EQ(pool.size(), 10);
+		EXPECT_EQ(Aligned::constructed, 10);
+
+		std::vector<Pool<Aligned>::Handle> held;
+		for (int i = 0; i < 10; i++) {
+			held.push_back(pool.acquire());
+			EXPECT_EQ(held.back()->value, i);
+			EXPECT_EQ(reinterpret_cast<std::uintptr_t>(held.back().get()) % 64, 0);
+		}
+		// objects of a slab are back to back
+		EXPECT_EQ(held[1].get() - held[0].get(), 1);
+		EXPECT_EQ(held[3].get() - held[0].get(), 3);
+
+		survivor = std::move(held[5]);
+	}
+	EXPECT_EQ(Aligned::destructed, 9);
+	EXPECT_EQ(survivor->tag, "slab");
+	survivor.reset();
+	EXPECT_EQ(Aligned::destructed, 10);
+}
+
+TEST(TestPool, SlabStride) {
+
+	Pool<int> pool(8);
+	for (int i = 0; i < 8; i++) pool.emplace(i);
+
+	// no per object header, ints sit at sizeof(int) from each other
+	std::vector<Pool<int>::Handle> held;
+	for (int i = 0; i < 8; i++) held.push_back(pool.acquire());
+	for (int i = 0; i < 8; i++) {
+		EXPECT_EQ(*held[i], i);
+		EXPECT_EQ(reinterpret_cast<char *>(held[i].get()) - reinterpret_cast<char *>(held[0].get()),
+			  i * sizeof(int));
+	}
+}
+
+TEST(TestPool, TimedAcquire) {
+
+	Pool<int> pool;
+	EXPECT_FALSE(pool.tryAcquire());
+
+	auto start = std::chrono::steady_clock::now();
+	EXPECT_FALSE(pool.acquireFor(std::chrono::milliseconds(20)));
+	EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(20));
+	EXPECT_EQ(pool.waiting(), 0);
+
+	pool.add(std::unique_ptr<int>(new int(3)));
+	auto v = pool.acquireFor(std::chrono::milliseconds(20));
+	ASSERT_TRUE(bool(v));
+	EXPECT_EQ(*v, 3);
+
+	// released from another thread while waiting
+	std::thread releaser([&v]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		v.reset();
+	});
+	auto w = pool.acquireFor(std::chrono::seconds(10));
+	releaser.join();
+	ASSERT_TRUE(bool(w));
+	EXPECT_EQ(*w, 3);
+}
+
+TEST(TestPool, HandOff) {
+
+	Pool<int> pool;
+	pool.add(std::unique_ptr<int>(new int(0)));
+	auto held = pool.acquire();
+
+	// waiters queue up in a known order
+	const int num_waiters = 4;
+	std::mutex mutex;
+	std::vector<int> served;
+	std::atomic<bool> go(false);
+	std::vector<std::thread> waiters;
+	for (int i = 0; i < num_waiters; i++) {
+		waiters.push_back(std::thread([&pool, &mutex, &served, &go, i]() {
+			auto v = pool.acquireWait();
+			EXPECT_TRUE(bool(v));
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				served.push_back(i);
+			}
+			while (!go) std::this_thread::yield();
+		}));
+		while (pool.waiting() != i + 1) std::this_thread::yield();
+	}
+
+	// a late tryAcquire must not jump the queue
+	held.reset();
+	EXPECT_FALSE(pool.tryAcquire());
+	go = true;
+
+	for (auto & w : waiters) w.join();
+	EXPECT_EQ(pool.waiting(), 0);
+	EXPECT_EQ(pool.size(), 1);
+	ASSERT_EQ(served.size(), num_waiters);
+	for (int i = 0; i < num_waiters; i++) EXPECT_EQ(served[i], i);
+}
+
+namespace {
+
+struct Counted {
+	Counted() { alive++; }
+	~Counted() { alive--; }
+	static int alive;
+};
+
+int Counted::alive = 0;
+
+}
+
+TEST(TestPool, Growth) {
+
+	Counted::alive = 0;
+	Pool<Counted>::Policy policy;
+	policy.grow_batch = 4;
+	policy.max_objects = 6;
+	Pool<Counted> pool([]() { return std::unique_ptr<Counted>(new Counted()); }, policy);
+	EXPECT_EQ(pool.total(), 0);
+
+	std::vector<Pool<Counted>::Handle> held;
+	held.push_back(pool.acquire());
+	EXPECT_EQ(pool.total(), 4);
+	EXPECT_EQ(pool.size(), 3);
+	for (int i = 0; i < 5; i++) held.push_back(pool.acquire());
+	EXPECT_EQ(pool.total(), 6);
+	EXPECT_FALSE(pool.tryAcquire());
+	EXPECT_FALSE(pool.acquireFor(std::chrono::milliseconds(1)));
+	held.clear();
+	EXPECT_EQ(Counted::alive, 6);
+
+	// the byte budget caps growth too
+	policy.max_objects = 0;
+	policy.max_bytes = 250;
+	policy.object_bytes = 100;
+	policy.heap_fallback = true;
+	Pool<Counted> budget([]() { return std::unique_ptr<Counted>(new Counted()); }, policy);
+	for (int i = 0; i < 3; i++) held.push_back(budget.acquire());
+	EXPECT_EQ(budget.total(), 2);
+	EXPECT_EQ(Counted::alive, 9);
+
+	// the fallback object is not pooled
+	held.pop_back();
+	EXPECT_EQ(Counted::alive, 8);
+	EXPECT_EQ(budget.size(), 0);
+
+	// a budget below one object pools none
+	policy.max_bytes = 50;
+	Pool<Counted> tiny([]() { return std::unique_ptr<Counted>(new Counted()); }, policy);
+	held.push_back(tiny.acquire());
+	EXPECT_EQ(tiny.total(), 0);
+	held.pop_back();
+	EXPECT_EQ(tiny.size(), 0);
+}
+
+TEST(TestPool, GrowthFactoryThrows) {
+
+	Counted::alive = 0;
+	Pool<Counted>::Policy policy;
+	policy.grow_batch = 4;
+	policy.max_objects = 6;
+	int calls = 0, fail = 1;
+	Pool<Counted> pool([&calls, &fail]() {
+		if (++calls == fail) throw std::runtime_error("factory");
+		return std::unique_ptr<Counted>(new Counted());
+	}, policy);
+
+	// the caller's own object fails
+	EXPECT_THROW(pool.tryAcquire(), std::runtime_error);
+	EXPECT_EQ(pool.total(), 0);
+
+	// the third of the batch fails, the caller still gets the first
+	fail = 4;
+	std::vector<Pool<Counted>::Handle> held;
+	held.push_back(pool.acquire());
+	EXPECT_EQ(pool.total(), 2);
+	EXPECT_EQ(pool.size(), 1);
+
+	// the objects not built are not lost against max_objects
+	for (int i = 0; i < 5; i++) held.push_back(pool.acquire());
+	EXPECT_EQ(pool.total(), 6);
+	EXPECT_FALSE(pool.tryAcquire());
+	EXPECT_EQ(Counted::alive, 6);
+}
+
+TEST(TestPool, Shrink) {
+
+	Counted::alive = 0;
+	Pool<Counted>::Policy policy;
+	policy.low_watermark = 2;
+	policy.idle_time = std::chrono::milliseconds(10);
+	Pool<Counted> pool([]() { return std::unique_ptr<Counted>(new Counted()); }, policy);
+
+	auto cycle = [&pool](int n) {
+		std::vector<Pool<Counted>::Handle> held;
+		for (int i = 0; i < n; i++) held.push_back(pool.acquire());
+	};
+
+	cycle(6);
+	EXPECT_EQ(pool.size(), 6);
+	pool.shrink();
+	EXPECT_EQ(pool.size(), 2);
+	EXPECT_EQ(Counted::alive, 2);
+
+	// objects in use during the period are kept
+	cycle(6);
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	cycle(1);
+	EXPECT_EQ(pool.total(), 6);
+
+	// a whole idle period with five unused, trimmed on the acquire
+	// while one is out
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	cycle(1);
+	EXPECT_EQ(pool.size(), 3);
+	EXPECT_EQ(pool.total(), 3);
+	EXPECT_EQ(Counted::alive, 3);
+}
+
+TEST(TestPool, IdleAfterPeak) {
+
+	Counted::alive = 0;
+	Pool<Counted>::Policy policy;
+	policy.low_watermark = 2;
+	policy.idle_time = std::chrono::milliseconds(10);
+	Pool<Counted> pool([]() { return std::unique_ptr<Counted>(new Counted()); }, policy);
+
+	{
+		std::vector<Pool<Counted>::Handle> peak;
+		for (int i = 0; i < 8; i++) peak.push_back(pool.acquire());
+	}
+	EXPECT_EQ(pool.total(), 8);
+
+	// after the peak objects are only acquired and kept, the first
+	// acquire past a period starts one, the next trims
+	std::vector<Pool<Counted>::Handle> held;
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	held.push_back(pool.acquire());
+	EXPECT_EQ(pool.total(), 8);
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	held.push_back(pool.acquire());
+	EXPECT_EQ(pool.size(), 2);
+	EXPECT_EQ(pool.total(), 4);
+	EXPECT_EQ(Counted::alive, 4);
+}
+
+TEST(TestPool, Order) {
+
+	Pool<int> fifo(Pool<int>::FIFO), lifo(Pool<int>::LIFO);
+	for (int i = 0; i < 3; i++) {
+		fifo.emplace(i);
+		lifo.emplace(i);
+	}
+	EXPECT_EQ(*fifo.acquire(), 0);
+	EXPECT_EQ(*fifo.acquire(), 1);
+	EXPECT_EQ(*lifo.acquire(), 2);
+	EXPECT_EQ(*lifo.acquire(), 2);
+}
+
+namespace {
+
+struct Buffer {
+	char data[4096];
+};
+
+}
+
+// Touches the whole object right after acquiring it. FIFO cycles through
+// every object (far more than the caches hold), LIFO keeps reusing one.
+TEST(TestPool, OrderBenchmark) {
+
+	const int num_objects = 2048;
+	const int iterations = 20000;
+
+	for (int order = Pool<Buffer>::FIFO; order <= Pool<Buffer>::LIFO; order++) {
+		Pool<Buffer> pool(num_objects, Pool<Buffer>::Order(order));
+		for (int i = 0; i < num_objects; i++) pool.emplace();
+
+		PerfCounters counters;
+		std::uint64_t before[PerfCounters::NUM_COUNTERS], after[PerfCounters::NUM_COUNTERS];
+		bool counted = counters.open() && counters.read(before);
+
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; i++) {
+			auto buffer = pool.acquire();
+			for (int b = 0; b < sizeof(buffer->data); b += 64) buffer->data[b]++;
+		}
+		double ns = std::chrono::duration<double, std::nano>(
+			std::chrono::steady_clock::now() - start).count() / iterations;
+
+		std::cout << (order == Pool<Buffer>::FIFO ? "FIFO: " : "LIFO: ") << ns << " ns per acquire";
+		if (counted && counters.read(after)) {
+			std::cout << ", " << double(after[PerfCounters::LLC_MISSES] - before[PerfCounters::LLC_MISSES]) / iterations
+				  << " cache misses, "
+				  << double(after[PerfCounters::CYCLES] - before[PerfCounters::CYCLES]) / iterations
+				  << " cycles";
+		}
+		std::cout << std::endl;
+	}
+}
+
+TEST(TestPool, Usage) {
+
+	Pool<int>::Policy policy;
+	policy.max_objects = 2;
+	Pool<int> pool([]() { return std::unique_ptr<int>(new int(0)); }, policy);
+	pool.setHoldTimeTracking(true);
+
+	{
+		auto a = pool.acquire();
+		auto b = pool.acquire();
+		EXPECT_FALSE(pool.tryAcquire());
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+	}
+	pool.acquire();
+
+	Pool<int>::Usage usage = pool.getUsage();
+	EXPECT_EQ(usage.acquires, 3);
+	EXPECT_EQ(usage.releases, 3);
+	EXPECT_EQ(usage.misses, 3); // two growths and the refused one
+	EXPECT_EQ(usage.outstanding, 0);
+	EXPECT_EQ(usage.peak, 2);
+	EXPECT_EQ(usage.hold_time.count(), 3);
+	EXPECT_GE(usage.hold_time.max(), 2000000);
+
+	int id = Profiler::addCounterSource("int pool", [&pool]() { return pool.getUsage().values(); });
+	auto counters = Profiler::getCounters();
+	ASSERT_EQ(counters.size(), 1);
+	EXPECT_EQ(counters[0].first, "int pool");
+	EXPECT_EQ(counters[0].second[4].first, "Peak");
+	EXPECT_EQ(counters[0].second[4].second, 2.0);
+
+	testing::internal::CaptureStdout();
+	Profiler::print();
+	std::string out = testing::internal::GetCapturedStdout();
+	EXPECT_NE(out.find("int pool"), std::string::npos);
+	EXPECT_NE(out.find("Hold p99 ms"), std::string::npos);
+
+	Profiler::removeCounterSource(id);
+	EXPECT_TRUE(Profiler::getCounters().empty());
+
+	pool.clearUsage();
+	EXPECT_EQ(pool.getUsage().acquires, 0);
+}
+
+TEST(TestPool, Batch) {
+
+	Pool<int>::Policy policy;
+	policy.grow_batch = 16;
+	policy.max_objects = 40;
+	Pool<int> pool([]() { return std::unique_ptr<int>(new int(0)); }, policy);
+
+	std::vector<Pool<int>::Handle> held;
+	EXPECT_EQ(pool.acquireN(std::back_inserter(held), 64), 40);
+	EXPECT_EQ(held.size(), 40);
+	EXPECT_EQ(pool.total(), 40);
+	EXPECT_EQ(pool.acquireN(std::back_inserter(held), 1), 0);
+
+	// a waiter gets the first of the batch
+	std::thread waiter([&pool]() { EXPECT_TRUE(bool(pool.acquireWait())); });
+	while (pool.waiting() != 1) std::this_thread::yield();
+
+	Pool<int> other;
+	other.add(std::unique_ptr<int>(new int(1)));
+	held.push_back(other.acquire());
+	held.push_back(Pool<int>::Handle());
+
+	pool.releaseN(held.begin(), held.end());
+	waiter.join();
+	for (auto & h : held) EXPECT_FALSE(h);
+	EXPECT_EQ(pool.size(), 40);
+	EXPECT_EQ(other.size(), 1);
+	EXPECT_EQ(pool.getUsage().releases, 41);
+}
+
+TEST(TestPool, BatchBenchmark) {
+
+	const int batch = 256;
+	const int rounds = 2000;
+
+	Pool<int> pool(batch);
+	for (int i = 0; i < batch; i++) pool.emplace(i);
+	std::vector<Pool<int>::Handle> held;
+	held.reserve(batch);
+
+	auto start = std::chrono::steady_clock::now();
+	for (int r = 0; r < rounds; r++) {
+		for (int i = 0; i < batch; i++) held.push_back(pool.acquire());
+		held.clear();
+	}
+	double single = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+	start = std::chrono::steady_clock::now();
+	for (int r = 0; r < rounds; r++) {
+		EXPECT_EQ(pool.acquireN(std::back_inserter(held), batch), batch);
+		pool.releaseN(held.begin(), held.end());
+		held.clear();
+	}
+	double batched = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+	std::cout << "Pool acquire/release per object: " << single / rounds / batch << " ns single, "
+		  << batched / rounds / batch << " ns in batches of " << batch << std::endl;
+}
@@ -0,0 +1,162 @@
+#include "gtest.h"
+#include "PoolAllocator.hpp"
+#include <cstring>
+#include <functional>
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace ByfronUtils;
+
+TEST(TestPoolAllocator, BlockPool) {
+
+	BlockPool pool(24);
+	void * a = pool.allocate();
+	void * b = pool.allocate();
+	EXPECT_EQ(static_cast<char *>(b) - static_cast<char *>(a), 24);
+
+	pool.deallocate(a);
+	EXPECT_EQ(pool.allocate(), a);
+
+	// more than a chunk
+	for (int i = 0; i < 10000; i++) EXPECT_NE(pool.allocate(), nullptr);
+}
+
+TEST(TestPoolAllocator, BlockCache) {
+
+	BlockPool pool(24, 8);
+	void * a = pool.allocate();
+	void * b = pool.allocate();
+	EXPECT_EQ(static_cast<char *>(b) - static_cast<char *>(a), 24);
+	pool.deallocate(b);
+	pool.deallocate(a);
+
+	// cached for this thread only, until flushed
+	void * other = nullptr;
+	std::thread([&pool, &other]() { other = pool.allocate(); }).join();
+	EXPECT_NE(other, a);
+	EXPECT_NE(other, b);
+
+	pool.flush();
+	std::set<void *> blocks;
+	std::thread([&pool, &blocks]() {
+		pool.flush();
+		for (int i = 0; i < 8; i++) blocks.insert(pool.allocate());
+	}).join();
+	EXPECT_EQ(blocks.count(a), 1);
+	EXPECT_EQ(blocks.count(b), 1);
+
+	// a full cache spills half, the blocks come back all the same
+	blocks.clear();
+	std::vector<void *> held;
+	for (int i = 0; i < 100; i++) held.push_back(pool.allocate());
+	for (void * p : held) pool.deallocate(p);
+	for (int i = 0; i < 100; i++) blocks.insert(pool.allocate());
+	EXPECT_EQ(blocks.size(), 100);
+	for (void * p : held) EXPECT_EQ(blocks.count(p), 1);
+}
+
+TEST(TestPoolAllocator, SharedAcrossThreads) {
+
+	PoolResource resource;
+	std::vector<std::thread> workers;
+	std::vector<std::vector<long *> > freed(4);
+	for (int t = 0; t < 4; t++) {
+		workers.push_back(std::thread([&resource, &freed, t]() {
+			std::vector<long *> mine;
+			for (int round = 0; round < 200; round++) {
+				for (int i = 0; i < 50; i++) {
+					long * p = static_cast<long *>(resource.allocate(sizeof(long) * (1 + i % 4)));
+					*p = t * 1000000 + round * 100 + i;
+					mine.push_back(p);
+				}
+				for (int i = 0; i < 50; i++) {
+					EXPECT_EQ(*mine[i], t * 1000000 + round * 100 + i);
+					resource.deallocate(mine[i], sizeof(long) * (1 + i % 4));
+				}
+				mine.clear();
+			}
+			// blocks freed here were allocated by another thread
+			for (int i = 0; i < 64; i++) freed[t].push_back(static_cast<long *>(resource.allocate(16)));
+		}));
+	}
+	for (auto & w : workers) w.join();
+	for (auto & f : freed)
+		for (long * p : f) resource.deallocate(p, 16);
+	resource.flush();
+}
+
+TEST(TestPoolAllocator, PoolResource) {
+
+	PoolResource resource;
+	EXPECT_EQ(resource.blockSize(1), 16);
+	EXPECT_EQ(resource.blockSize(1, 8), 8);
+	EXPECT_EQ(resource.blockSize(17), 32);
+	EXPECT_EQ(resource.blockSize(72, 8), 80);
+	EXPECT_EQ(resource.blockSize(72, 16), 80);
+	EXPECT_EQ(resource.blockSize(100, 16), 112);
+	EXPECT_EQ(resource.blockSize(60, 16), 64);
+	EXPECT_EQ(resource.blockSize(512), 512);
+	EXPECT_EQ(resource.blockSize(513), 0);
+	EXPECT_EQ(resource.blockSize(8, 64), 0);
+
+	for (std::size_t bytes = 1; bytes <= 1024; bytes += 7) {
+		for (std::size_t alignment = 1; alignment <= 64; alignment *= 2) {
+			void * p = resource.allocate(bytes, alignment);
+			EXPECT_EQ(reinterpret_cast<std::uintptr_t>(p) % alignment, 0);
+			memset(p, 0xab, bytes);
+			resource.deallocate(p, bytes, alignment);
+		}
+	}
+
+	// blocks of a class come back
+	void * p = resource.allocate(100);
+	resource.deallocate(p, 100);
+	EXPECT_EQ(resource.allocate(97), p);
+}
+
+TEST(TestPoolAllocator, Containers) {
+
+	PoolResource resource;
+	PoolAllocator<int> alloc(&resource);
+
+	std::list<int, PoolAllocator<int> > list(alloc);
+	for (int i = 0; i < 1000; i++) list.push_back(i);
+	list.remove_if([](int i) { return i % 2; });
+	EXPECT_EQ(list.size(), 500);
+
+	typedef std::pair<const int, std::string> Entry;
+	std::map<int, std::string, std::less<int>, PoolAllocator<Entry> > map(
+		(std::less<int>()), PoolAllocator<Entry>(&resource));
+	std::unordered_map<int, std::string, std::hash<int>, std::equal_to<int>, PoolAllocator<Entry> > hash(
+		16, std::hash<int>(), std::equal_to<int>(), PoolAllocator<Entry>(&resource));
+	for (int i = 0; i < 1000; i++) {
+		map[i] = std::to_string(i);
+		hash[i] = std::to_string(i);
+	}
+	EXPECT_EQ(map[500], "500");
+	EXPECT_EQ(hash[999], "999");
+	EXPECT_TRUE(map.get_allocator() == alloc);
+
+	// default allocators share one resource
+	std::list<int, PoolAllocator<int> > shared;
+	shared.push_back(1);
+	EXPECT_EQ(shared.get_allocator().resource(), &PoolResource::shared());
+}
+
+#ifdef BYFRON_HAS_PMR
+TEST(TestPoolAllocator, Pmr) {
+
+	PoolResource resource;
+	PmrPoolResource pmr(resource);
+	std::pmr::list<int> list(&pmr);
+	for (int i = 0; i < 100; i++) list.push_back(i);
+	EXPECT_EQ(list.size(), 100);
+	EXPECT_TRUE(pmr.is_equal(PmrPoolResource(resource)));
+	EXPECT_FALSE(pmr.is_equal(PmrPoolResource()));
+}
+#endif
@@ -1,6 +1,12 @@
 #include "gtest.h"
 #include "Profiler.hpp"
+#include "TraceFile.hpp"
 #include <unistd.h>
+#include <dirent.h>
+#include <atomic>
+#include <thread>
+#include <sstream>
+#include <map>
 
 using namespace ByfronUtils;
 unsigned int microseconds;
@@ -108,3 +114,387 @@ TEST(TestProfiler, Paralel) {
 
 }
 
+
+TEST(TestProfiler, ThreadLocal) {
+
+	std::vector<std::thread> workers;
+	for (int t = 0; t < 4; t++) {
+		workers.push_back(std::thread([]() {
+			for (int i = 0; i < 100; i++) {
+				__PROF(T1)
+				__PROF(T2)
+			}
+		}));
+	}
+	for (auto & w : workers) w.join();
+
+	// records outlive the threads that wrote them
+	std::vector<Profiler::Stats> fstats = Profiler::getFusedStats();
+	int t1 = -1;
+	for (int i = 0; i < fstats.size(); i++) {
+		if (fstats[i].key == "T1") t1 = i;
+	}
+	ASSERT_GE(t1, 0);
+	EXPECT_EQ(fstats[t1].count, 400);
+	EXPECT_TRUE(fstats[t1].paralel);
+	EXPECT_EQ(fstats[fstats[t1].parent].key, "__root__");
+
+	for (auto s : fstats) {
+		if (s.key == "T2") {
+			EXPECT_EQ(s.count, 400);
+			EXPECT_EQ(s.parent, t1);
+		}
+	}
+
+	Profiler::clear();
+	EXPECT_TRUE(Profiler::getFusedStats().empty());
+}
+
+TEST(TestProfiler, ReportWhileRecording) {
+
+	Profiler::setEventRecording(true);
+	std::atomic<bool> done(false), running(false);
+	std::thread worker([&done, &running]() {
+		while (!done.load()) {
+			__PROF(R1)
+			__PROF(R2)
+			running.store(true);
+		}
+	});
+	while (!running.load()) std::this_thread::yield();
+
+	// reports and clear() may run while other threads record, clearing
+	// every round keeps the recorded events to what a round lets through
+	for (int i = 0; i < 200; i++) {
+		Profiler::getFusedStats();
+		std::stringstream ss;
+		Profiler::printChromeTrace(ss);
+		Profiler::clear();
+	}
+	done.store(true);
+	worker.join();
+
+	Profiler::setEventRecording(false);
+	Profiler::clear();
+}
+
+TEST(TestProfiler, ClearedWhileOpen) {
+
+	{
+		__PROF(G1)
+		Profiler::clear();
+		{
+			__PROF(G2)
+		}
+		{
+			__PROF(G3)
+		}
+		usleep(50000);
+	}
+
+	// G1 was cleared, its end must not land on the records that replaced it
+	EXPECT_EQ(Profiler::getNumCalls("G2"), 1);
+	EXPECT_LT(Profiler::getTimeInMilis("G2"), 25.0);
+	for (auto s : Profiler::getFusedStats()) EXPECT_NE(s.key, "G1");
+	Profiler::clear();
+}
+
+TEST(TestProfiler, Sites) {
+
+	static_assert(Profiler::hash("P1") != Profiler::hash("P2"), "site hashes are compile-time");
+
+	Profiler::Site a("S1", __FILE__, __LINE__, Profiler::hash("S1"));
+	Profiler::Site b("S1", __FILE__, __LINE__, Profiler::hash("S1"));
+	Profiler::Site c("S2", __FILE__, __LINE__, Profiler::hash("S2"));
+	EXPECT_EQ(a.id, b.id);
+	EXPECT_NE(a.id, c.id);
+
+	for (int i = 0; i < 3; i++) {
+		__PROF(S1)
+	}
+	{
+		Profiler p(b);
+	}
+	{
+		Profiler p(std::string("S1"));
+	}
+
+	EXPECT_EQ(Profiler::getNumCalls("S1"), 5);
+	Profiler::clear();
+}
+
+TEST(TestProfiler, TscClock) {
+
+	std::uint64_t t0 = TscClock::now();
+	usleep(50000);
+	std::uint64_t t1 = TscClock::now();
+
+	EXPECT_GT(t1, t0);
+	double ms = (t1 - t0) * TscClock::ns_per_tick() / 1e6;
+	EXPECT_GT(ms, 45.0);
+	EXPECT_LT(ms, 100.0);
+	if (!TscClock::invariant()) {
+		EXPECT_EQ(TscClock::ns_per_tick(), 1.0);
+	}
+}
+
+TEST(TestProfiler, ChromeTrace) {
+
+	Profiler::setEventRecording(true);
+
+	std::thread worker([]() {
+		__PROF(E1)
+		__PROF(E2)
+	});
+	worker.join();
+
+	for (int i = 0; i < 2; i++) {
+		__PROF(E1)
+	}
+
+	Profiler::setEventRecording(false);
+	{
+		__PROF(E3)
+	}
+
+	std::stringstream ss;
+	Profiler::printChromeTrace(ss);
+	std::string json = ss.str();
+
+	auto count = [&json](const std::string & str) {
+		int n = 0;
+		for (size_t pos = json.find(str); pos != std::string::npos; pos = json.find(str, pos + 1)) n++;
+		return n;
+	};
+
+	EXPECT_EQ(json.find("{\"displayTimeUnit\":\"ns\",\"traceEvents\":["), 0);
+	EXPECT_EQ(count("\"ph\":\"B\""), 4);
+	EXPECT_EQ(count("\"ph\":\"E\""), 4);
+	EXPECT_EQ(count("\"name\":\"E1\""), 6);
+	EXPECT_EQ(count("\"name\":\"E2\""), 2);
+	EXPECT_EQ(count("\"name\":\"E3\""), 0);
+	EXPECT_EQ(count("\"ph\":\"M\""), 2);
+
+	Profiler::clear();
+}
+
+TEST(TestProfiler, Percentiles) {
+
+	for (int i = 0; i < 20; i++) {
+		__PROF(H1)
+		usleep(i == 19 ? 50000 : 1000);
+	}
+
+	EXPECT_LT(Profiler::getPercentileInMilis("H1", 50), 10.0);
+	EXPECT_GE(Profiler::getPercentileInMilis("H1", 99), 50.0);
+	EXPECT_GE(Profiler::getMaxInMilis("H1"), 50.0);
+	EXPECT_EQ(Profiler::getPercentileInMilis("H1", 100), Profiler::getMaxInMilis("H1"));
+
+	Profiler::print();
+	Profiler::clear();
+}
+
+TEST(TestProfiler, HardwareCounters) {
+
+	bool available = Profiler::setHardwareCounters(true);
+
+	volatile double x = 0;
+	for (int i = 0; i < 10; i++) {
+		__PROF(C1)
+		for (int j = 0; j < 10000; j++) x += j;
+	}
+
+	Profiler::setHardwareCounters(false);
+
+	// time is recorded whether or not the counters could be opened
+	EXPECT_EQ(Profiler::getNumCalls("C1"), 10);
+	for (auto s : Profiler::getFusedStats()) {
+		if (s.key != "C1") continue;
+		if (available) {
+			EXPECT_EQ(s.counted, 10);
+			EXPECT_GT(s.counters[PerfCounters::INSTRUCTIONS], 10 * 10000);
+			EXPECT_GT(s.ipc(), 0);
+		}
+		else {
+			EXPECT_EQ(s.counted, 0);
+			EXPECT_EQ(s.ipc(), 0);
+		}
+	}
+
+	Profiler::print();
+	Profiler::clear();
+}
+
+TEST(TestProfiler, CountersClosedOnThreadExit) {
+
+	auto open_fds = []() {
+		int n = 0;
+		if (DIR * dir = opendir("/proc/self/fd")) {
+			while (readdir(dir)) n++;
+			closedir(dir);
+		}
+		return n;
+	};
+
+	int before = open_fds();
+	Profiler::setHardwareCounters(true);
+	for (int t = 0; t < 8; t++) {
+		std::thread worker([]() {
+			__PROF(C2)
+		});
+		worker.join();
+	}
+	Profiler::setHardwareCounters(false);
+
+	// only the calling thread's group may stay open
+	EXPECT_LE(open_fds(), before + PerfCounters::NUM_COUNTERS);
+	Profiler::clear();
+}
+
+TEST(TestProfiler, FusedParents) {
+
+	// U2 is first seen alone, U1 under another thread's U2 record
+	std::thread([]() {
+		__PROF(U2)
+	}).join();
+	std::thread([]() {
+		__PROF(U2)
+		__PROF(U1)
+	}).join();
+
+	std::vector<Profiler::Stats> fstats = Profiler::getFusedStats();
+	std::map<std::string, int> index;
+	for (int i = 0; i < fstats.size(); i++) index[fstats[i].key] = i;
+	ASSERT_EQ(index.size(), 3);
+	EXPECT_EQ(fstats[index["U1"]].parent, index["U2"]);
+	EXPECT_EQ(fstats[index["U2"]].parent, index["__root__"]);
+	EXPECT_EQ(fstats[index["__root__"]].parent, -1);
+
+	std::stringstream ss;
+	Profiler::printFoldedStacks(ss);
+	EXPECT_NE(ss.str().find("__root__;U2;U1 "), std::string::npos);
+
+	Profiler::clear();
+}
+
+TEST(TestProfiler, FoldedStacks) {
+
+	{
+		__PROF(F1)
+		usleep(10000);
+		{
+			__PROF(F2)
+			usleep(20000);
+		}
+	}
+
+	std::stringstream ss;
+	Profiler::printFoldedStacks(ss);
+
+	std::map<std::string, double> self;
+	std::string stack;
+	double ns;
+	while (ss >> stack >> ns) self[stack] = ns / 1e6;
+
+	ASSERT_TRUE(self.count("__root__;F1"));
+	ASSERT_TRUE(self.count("__root__;F1;F2"));
+	EXPECT_NEAR(self["__root__;F1"], 10.0, 5.0);
+	EXPECT_NEAR(self["__root__;F1;F2"], 20.0, 5.0);
+
+	Profiler::clear();
+}
+
+TEST(TestProfiler, Aggregator) {
+
+	Profiler::startAggregator();
+	EXPECT_TRUE(Profiler::isAggregating());
+
+	std::vector<std::thread> workers;
+	for (int t = 0; t < 4; t++) {
+		workers.push_back(std::thread([]() {
+			for (int i = 0; i < 10000; i++) {
+				__PROF(A1)
+				__PROF(A2)
+			}
+		}));
+	}
+	for (auto & w : workers) w.join();
+
+	// exited threads were drained, the reports flush anything left
+	std::vector<Profiler::Stats> fstats = Profiler::getFusedStats();
+	int a1 = -1;
+	for (int i = 0; i < fstats.size(); i++) {
+		if (fstats[i].key == "A1") a1 = i;
+	}
+	ASSERT_GE(a1, 0);
+	EXPECT_EQ(fstats[a1].count, 40000);
+	EXPECT_EQ(fstats[a1].histogram.count(), 40000);
+	for (auto s : fstats) {
+		if (s.key == "A2") {
+			EXPECT_EQ(s.count, 40000);
+			EXPECT_EQ(s.parent, a1);
+		}
+	}
+
+	{
+		__PROF(A3)
+	}
+	EXPECT_EQ(Profiler::getNumCalls("A3"), 1);
+
+	Profiler::stopAggregator();
+	EXPECT_FALSE(Profiler::isAggregating());
+	{
+		__PROF(A3)
+	}
+	EXPECT_EQ(Profiler::getNumCalls("A3"), 2);
+
+	Profiler::clear();
+}
+
+TEST(TestProfiler, BinaryTrace) {
+
+	const char * filename = "test_trace.bin";
+	ASSERT_TRUE(Profiler::startTrace(filename));
+
+	std::vector<std::thread> workers;
+	for (int t = 0; t < 2; t++) {
+		workers.push_back(std::thread([]() {
+			for (int i = 0; i < 20000; i++) {
+				__PROF(B1)
+				__PROF(B2)
+			}
+		}));
+	}
+	for (auto & w : workers) w.join();
+	{
+		__PROF(B3)
+	}
+	Profiler::stopTrace();
+	EXPECT_EQ(Profiler::getDroppedTraceEvents(), 0);
+
+	TraceReader reader(filename);
+	ASSERT_TRUE(reader.valid());
+
+	std::map<std::string, int> begins, ends;
+	std::map<std::uint32_t, std::uint64_t> last;
+	long events = 0;
+	TraceReader::Event e;
+	while (reader.next(e)) {
+		std::string name = reader.name(e.key_id);
+		if (e.phase == 'B') begins[name]++;
+		else ends[name]++;
+		EXPECT_GE(e.time, last[e.thread]);
+		last[e.thread] = e.time;
+		events++;
+	}
+
+	EXPECT_EQ(begins["B1"], 40000);
+	EXPECT_EQ(ends["B2"], 40000);
+	EXPECT_EQ(begins["B3"], 1);
+	EXPECT_EQ(ends["B3"], 1);
+	EXPECT_EQ(events, 160002);
+	EXPECT_LT(double(reader.size()) / events, 4.0);
+
+	unlink(filename);
+	Profiler::clear();
+}
@@ -0,0 +1,73 @@
+#include "gtest.h"
+#define BYFRON_PROFILER_DISABLE
+#include "Profiler.hpp"
+
+using namespace ByfronUtils;
+
+static_assert(std::is_empty<NullProfiler>::value, "disabled scopes hold no state");
+static_assert(std::is_trivially_destructible<NullProfiler>::value, "disabled scopes run no code");
+
+#if defined(__x86_64__) && defined(__ELF__) && defined(__GNUC__) && !defined(__clang__)
+#define COMPARE_CODEGEN
+#endif
+
+// With COMPARE_CODEGEN each kernel gets a section of its own, which the
+// linker brackets with __start_ and __stop_ symbols
+#if defined(COMPARE_CODEGEN)
+#define KERNEL_ATTRIBUTES(section_name) __attribute__((noinline, optimize("O2"), section(#section_name)))
+#elif defined(__GNUC__) && !defined(__clang__)
+#define KERNEL_ATTRIBUTES(section_name) __attribute__((noinline, optimize("O2")))
+#else
+#define KERNEL_ATTRIBUTES(section_name) __attribute__((noinline))
+#endif
+
+KERNEL_ATTRIBUTES(byfron_plain_kernel) long plainKernel(long n) {
+	long sum = 0;
+	for (long i = 0; i < n; i++) {
+		sum += i * i;
+	}
+	return sum;
+}
+
+KERNEL_ATTRIBUTES(byfron_instrumented_kernel) long instrumentedKernel(long n) {
+	__PROF(D1)
+	long sum = 0;
+	for (long i = 0; i < n; i++) {
+		__PROF(D2)
+		sum += i * i;
+		__STOP(D2)
+	}
+	return sum;
+}
+
+TEST(TestProfilerDisabled, NothingRecorded) {
+
+	EXPECT_EQ(instrumentedKernel(1000), plainKernel(1000));
+
+	for (auto s : Profiler::getFusedStats()) {
+		EXPECT_NE(s.key, "D1");
+		EXPECT_NE(s.key, "D2");
+	}
+}
+
+#ifdef COMPARE_CODEGEN
+extern "C" const unsigned char __start_byfron_plain_kernel[], __stop_byfron_plain_kernel[];
+extern "C" const unsigned char __start_byfron_instrumented_kernel[], __stop_byfron_instrumented_kernel[];
+
+TEST(TestProfilerDisabled, IdenticalCodegen) {
+
+	// both kernels are compiled at -O2 and contain no relative calls, so
+	// their machine code must match byte for byte over the whole section
+	const unsigned char * plain = __start_byfron_plain_kernel;
+	const unsigned char * instrumented = __start_byfron_instrumented_kernel;
+	std::size_t plain_size = __stop_byfron_plain_kernel - plain;
+	std::size_t instrumented_size = __stop_byfron_instrumented_kernel - instrumented;
+
+	ASSERT_EQ(reinterpret_cast<const unsigned char *>(&plainKernel), plain);
+	ASSERT_EQ(reinterpret_cast<const unsigned char *>(&instrumentedKernel), instrumented);
+	ASSERT_GT(plain_size, 0);
+	ASSERT_EQ(plain_size, instrumented_size);
+	for (std::size_t i = 0; i < plain_size; i++)
+		ASSERT_EQ(plain[i], instrumented[i]) << "at byte " << i;
+}
+#endif
@@ -0,0 +1,52 @@
+#include "gtest.h"
+#define BYFRON_PROFILER_CLOCK TscClock
+#include "Profiler.hpp"
+#include <unistd.h>
+#include <chrono>
+#include <type_traits>
+
+using namespace ByfronUtils;
+
+static_assert(std::is_same<ProfilerClock, TscClock>::value, "profiler reads the TSC");
+
+// Busy waits for ms milliseconds of steady_clock time
+static void spin(int ms) {
+	typedef std::chrono::steady_clock clock;
+	clock::time_point t0 = clock::now();
+	while (clock::now() - t0 < std::chrono::milliseconds(ms)) {}
+}
+
+TEST(TestProfilerTsc, Sleep) {
+
+	{
+		__PROF(T1)
+		usleep(50000);
+		{
+			__PROF(T2)
+			usleep(20000);
+		}
+	}
+
+	EXPECT_GE(Profiler::getTimeInMilis("T1"), 69.0);
+	EXPECT_LT(Profiler::getTimeInMilis("T1"), 120.0);
+	EXPECT_GE(Profiler::getTimeInMilis("T2"), 19.0);
+	EXPECT_LT(Profiler::getTimeInMilis("T2"), 50.0);
+	EXPECT_GE(Profiler::getTimeInMilis("__root__"), Profiler::getTimeInMilis("T1"));
+	Profiler::clear();
+}
+
+TEST(TestProfilerTsc, Spin) {
+
+	for (int i = 0; i < 4; i++) {
+		__PROF(T3)
+		spin(10);
+	}
+
+	// ticks are only converted at report time, a wrong ratio shows here
+	EXPECT_EQ(Profiler::getNumCalls("T3"), 4);
+	EXPECT_GE(Profiler::getTimeInMilis("T3"), 39.0);
+	EXPECT_LT(Profiler::getTimeInMilis("T3"), 60.0);
+	EXPECT_GE(Profiler::getMaxInMilis("T3"), 9.5);
+	EXPECT_LT(Profiler::getMaxInMilis("T3"), 15.0);
+	Profiler::clear();
+}
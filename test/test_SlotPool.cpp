@@ -0,0 +1,59 @@
+#include "gtest.h"
+#include "SlotPool.hpp"
+#include <string>
+
+using namespace ByfronUtils;
+
+TEST(TestSlotPool, SlotPool) {
+
+	static_assert(sizeof(SlotPool<int>::Handle) == 4, "32 bit handle");
+	static_assert(sizeof(SlotPool<int, std::uint64_t>::Handle) == 8, "64 bit handle");
+
+	SlotPool<std::string> pool;
+	EXPECT_FALSE(pool.acquire());
+	for (int i = 0; i < 3; i++) pool.emplace("object");
+	EXPECT_EQ(pool.size(), 3);
+
+	SlotPool<std::string>::Handle a = pool.acquire();
+	SlotPool<std::string>::Handle b = pool.acquire();
+	ASSERT_TRUE(bool(a));
+	ASSERT_NE(a, b);
+	*pool.get(a) = "a";
+	EXPECT_EQ(*pool.get(a), "a");
+	EXPECT_EQ(pool.get(SlotPool<std::string>::Handle()), nullptr);
+
+	// a released handle goes stale, even once its slot is reused
+	EXPECT_TRUE(pool.release(a));
+	EXPECT_FALSE(pool.valid(a));
+	EXPECT_EQ(pool.get(a), nullptr);
+	EXPECT_FALSE(pool.release(a));
+
+	SlotPool<std::string>::Handle c = pool.acquire();
+	EXPECT_EQ(c.index(), a.index());
+	EXPECT_NE(c, a);
+	EXPECT_EQ(pool.get(a), nullptr);
+	EXPECT_EQ(*pool.get(c), "a");
+
+	// out of range
+	EXPECT_EQ(pool.get(SlotPool<std::string>::Handle(5 | (1 << SlotPool<std::string>::INDEX_BITS))), nullptr);
+	EXPECT_TRUE(pool.valid(b));
+}
+
+TEST(TestSlotPool, GenerationWraps) {
+
+	SlotPool<int> pool;
+	pool.emplace(0);
+
+	SlotPool<int>::Handle first = pool.acquire();
+	pool.release(first);
+	for (int i = 0; i < SlotPool<int>::MAX_GENERATION - 2; i++) pool.release(pool.acquire());
+
+	SlotPool<int>::Handle h = pool.acquire();
+	EXPECT_EQ(h.generation(), SlotPool<int>::MAX_GENERATION);
+	pool.release(h);
+
+	// never wraps to the invalid handle
+	h = pool.acquire();
+	EXPECT_TRUE(bool(h));
+	EXPECT_EQ(h, first);
+}
@@ -0,0 +1,49 @@
+#include "gtest.h"
+#include "SpscRing.hpp"
+#include <thread>
+
+using namespace ByfronUtils;
+
+TEST(TestSpscRing, FullAndEmpty) {
+
+	SpscRing<int> ring(3);
+	EXPECT_EQ(ring.capacity(), 4);
+	EXPECT_TRUE(ring.empty());
+
+	int v;
+	EXPECT_FALSE(ring.pop(v));
+	for (int i = 0; i < 4; i++) EXPECT_TRUE(ring.push(i));
+	EXPECT_FALSE(ring.push(4));
+
+	EXPECT_TRUE(ring.pop(v));
+	EXPECT_EQ(v, 0);
+	EXPECT_TRUE(ring.push(4));
+	for (int i = 1; i < 5; i++) {
+		EXPECT_TRUE(ring.pop(v));
+		EXPECT_EQ(v, i);
+	}
+	EXPECT_TRUE(ring.empty());
+}
+
+TEST(TestSpscRing, ProducerConsumer) {
+
+	SpscRing<long> ring(64);
+	const long n = 200000;
+
+	std::thread producer([&ring, n]() {
+		for (long i = 0; i < n; i++) {
+			while (!ring.push(i)) std::this_thread::yield();
+		}
+	});
+
+	long expected = 0, v;
+	while (expected < n) {
+		if (ring.pop(v)) {
+			ASSERT_EQ(v, expected);
+			expected++;
+		}
+		else std::this_thread::yield();
+	}
+	producer.join();
+	EXPECT_TRUE(ring.empty());
+}
@@ -0,0 +1,51 @@
+#include "gtest.h"
+#include "StaticPool.hpp"
+#include <string>
+#include <vector>
+
+using namespace ByfronUtils;
+
+TEST(TestStaticPool, StaticPool) {
+
+	StaticPool<std::string, 4> pool("free");
+	EXPECT_EQ(pool.size(), 4);
+	EXPECT_EQ(pool.capacity(), 4);
+
+	std::vector<StaticPool<std::string, 4>::PtrType> held;
+	for (int i = 0; i < 4; i++) {
+		held.push_back(pool.acquire());
+		ASSERT_TRUE(bool(held.back()));
+		EXPECT_EQ(*held.back(), "free");
+		*held.back() = "used";
+	}
+	EXPECT_TRUE(pool.empty());
+	EXPECT_FALSE(pool.acquire());
+
+	// the last released object comes back first, still built
+	std::string * last = held[2].get();
+	held[2].reset();
+	EXPECT_EQ(pool.size(), 1);
+	auto again = pool.acquire();
+	EXPECT_EQ(again.get(), last);
+	EXPECT_EQ(*again, "used");
+
+	held.clear();
+	again.reset();
+	EXPECT_EQ(pool.size(), 4);
+}
+
+TEST(TestStaticPool, Inline) {
+
+	struct alignas(32) Particle {
+		float x, y, z;
+	};
+
+	// storage, a byte per free-list link and the bookkeeping
+	static_assert(sizeof(StaticPool<Particle, 100>) <= 100 * sizeof(Particle) + 100 + 64, "inline storage");
+
+	StaticPool<Particle, 100> pool;
+	auto p = pool.acquire();
+	EXPECT_EQ(reinterpret_cast<std::uintptr_t>(p.get()) % 32, 0);
+	EXPECT_GE(reinterpret_cast<char *>(p.get()), reinterpret_cast<char *>(&pool));
+	EXPECT_LT(reinterpret_cast<char *>(p.get()), reinterpret_cast<char *>(&pool) + sizeof(pool));
+}